@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "debug.h"
+#include "exception.h"
+
+size_t exception_batch(void *items, size_t count, size_t size,
+		void (*func)(void *item, void *arg), void *arg,
+		exception_result_t *results)
+{
+	/* modified between setjmp and longjmp */
+	volatile size_t i = 0;
+	volatile size_t failed = 0;
+	volatile bool running = false;
+	jmp_buf env;
+
+	/* the batch may be left before all items are reached */
+	if (results)
+		memset(results, 0, count * sizeof(*results));
+
+	if (setjmp(env) != 0) {
+		/* thrown by tryenv_push, e.g. a posted exception, ends the batch */
+		if (!running)
+			tryenv_jmp(__builtin_frame_address(0));
+
+		running = false;
+		debug("item %zu failed with errno = %d", i, exception_errno());
+
+		if (results) {
+			results[i].errnum = exception_errno();
+			results[i].trace = exception_print_all();
+		}
+
+		exception_clear();
+		failed++;
+		i++;
+	}
+
+	/* the environment is only pushed again after an item failed */
+	tryenv_push(&env, 0, __builtin_frame_address(0), __FILE__, __LINE__,
+			__FUNCTION__);
+
+	running = true;
+
+	for (; i < count; i++)
+		func((char *) items + i * size, arg);
+
+	tryenv_pop(__builtin_frame_address(0));
+	return failed;
+}
+
+void exception_batch_free(exception_result_t *results, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		free(results[i].trace);
+		results[i].trace = NULL;
+	}
+}
@@ -0,0 +1,19 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "checked.h"
+
+void __checked_fail(const char *file, int line, const char *func,
+		int errnum, const char *call)
+{
+	char buf[128];
+
+	exception_push(file, line, func, errnum, "%s: %s", call,
+			strerror_r(errnum, buf, sizeof(buf)));
+	tryenv_jmp(__builtin_frame_address(0));
+
+	/* not reached, tryenv_jmp aborts if no environment is left */
+	abort();
+}
@@ -0,0 +1,240 @@
+// Copyright (c) 2006-2009 Benedikt Böhm <bb@xnull.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _CHECKED_H
+#define _CHECKED_H
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <exception.h>
+
+/*! @defgroup checked checked system calls
+ *
+ * The checked API wraps common libc and POSIX calls and throws an exception
+ * with the captured <tt>errno</tt> if they fail. the success path is inlined
+ * into the caller, the failure path is kept out of line.
+ *
+ * @{
+ */
+
+/*! @brief throw exception for failed call
+ *
+ * <tt>__checked_fail</tt> throws an exception for <tt>errnum</tt> with a
+ * message naming the failed call.
+ *
+ * @note this function should not be used directly, the checked wrappers
+ * provide better semantics.
+ *
+ * @param file   source file of the call
+ * @param line   source line of the call
+ * @param func   function containing the call
+ * @param errnum <tt>errno</tt> value of the failed call
+ * @param call   name of the failed call
+ */
+void __checked_fail(const char *file, int line, const char *func,
+		int errnum, const char *call)
+	__attribute__((cold, noinline, noreturn));
+
+#define __checked(cond, call, errnum) do { \
+	if (__builtin_expect(!!(cond), 0)) \
+		__checked_fail(file, line, func, errnum, call); \
+} while (0)
+
+#define __checked_site const char *file, int line, const char *func
+
+static inline
+ssize_t __xread(__checked_site, int fd, void *buf, size_t count)
+{
+	ssize_t ret = read(fd, buf, count);
+	__checked(ret < 0, "read", errno);
+	return ret;
+}
+
+static inline
+ssize_t __xwrite(__checked_site, int fd, const void *buf, size_t count)
+{
+	ssize_t ret = write(fd, buf, count);
+	__checked(ret < 0, "write", errno);
+	return ret;
+}
+
+static inline
+int __xopen(__checked_site, const char *path, int flags, mode_t mode)
+{
+	int fd = open(path, flags, mode);
+	__checked(fd < 0, "open", errno);
+	return fd;
+}
+
+static inline
+void __xclose(__checked_site, int fd)
+{
+	__checked(close(fd) < 0, "close", errno);
+}
+
+static inline
+void __xpipe(__checked_site, int fds[2])
+{
+	__checked(pipe(fds) < 0, "pipe", errno);
+}
+
+static inline
+int __xdup2(__checked_site, int oldfd, int newfd)
+{
+	int fd = dup2(oldfd, newfd);
+	__checked(fd < 0, "dup2", errno);
+	return fd;
+}
+
+static inline
+void *__xmalloc(__checked_site, size_t size)
+{
+	void *ptr = malloc(size);
+	__checked(ptr == NULL && size > 0, "malloc", errno);
+	return ptr;
+}
+
+static inline
+void *__xcalloc(__checked_site, size_t nmemb, size_t size)
+{
+	void *ptr = calloc(nmemb, size);
+	__checked(ptr == NULL && nmemb > 0 && size > 0, "calloc", errno);
+	return ptr;
+}
+
+static inline
+void *__xrealloc(__checked_site, void *ptr, size_t size)
+{
+	void *new = realloc(ptr, size);
+	__checked(new == NULL && size > 0, "realloc", errno);
+	return new;
+}
+
+static inline
+char *__xstrdup(__checked_site, const char *s)
+{
+	char *new = strdup(s);
+	__checked(new == NULL, "strdup", errno);
+	return new;
+}
+
+static inline
+void *__xmmap(__checked_site, void *addr, size_t length, int prot,
+		int flags, int fd, off_t offset)
+{
+	void *ptr = mmap(addr, length, prot, flags, fd, offset);
+	__checked(ptr == MAP_FAILED, "mmap", errno);
+	return ptr;
+}
+
+static inline
+void __xmunmap(__checked_site, void *addr, size_t length)
+{
+	__checked(munmap(addr, length) < 0, "munmap", errno);
+}
+
+static inline
+void __xpthread_mutex_lock(__checked_site, pthread_mutex_t *mutex)
+{
+	int ret = pthread_mutex_lock(mutex);
+	__checked(ret != 0, "pthread_mutex_lock", ret);
+}
+
+static inline
+void __xpthread_mutex_unlock(__checked_site, pthread_mutex_t *mutex)
+{
+	int ret = pthread_mutex_unlock(mutex);
+	__checked(ret != 0, "pthread_mutex_unlock", ret);
+}
+
+static inline
+void __xpthread_create(__checked_site, pthread_t *thread,
+		const pthread_attr_t *attr, void *(*start)(void *), void *arg)
+{
+	int ret = pthread_create(thread, attr, start, arg);
+	__checked(ret != 0, "pthread_create", ret);
+}
+
+#undef __checked_site
+#undef __checked
+
+#define __checked_call(call, ...) \
+	__##call(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+
+/*! @brief checked <tt>read</tt> */
+#define xread(fd, buf, count) __checked_call(xread, fd, buf, count)
+
+/*! @brief checked <tt>write</tt> */
+#define xwrite(fd, buf, count) __checked_call(xwrite, fd, buf, count)
+
+/*! @brief checked <tt>open</tt>, the mode argument is mandatory */
+#define xopen(path, flags, mode) __checked_call(xopen, path, flags, mode)
+
+/*! @brief checked <tt>close</tt> */
+#define xclose(fd) __checked_call(xclose, fd)
+
+/*! @brief checked <tt>pipe</tt> */
+#define xpipe(fds) __checked_call(xpipe, fds)
+
+/*! @brief checked <tt>dup2</tt> */
+#define xdup2(oldfd, newfd) __checked_call(xdup2, oldfd, newfd)
+
+/*! @brief checked <tt>malloc</tt> */
+#define xmalloc(size) __checked_call(xmalloc, size)
+
+/*! @brief checked <tt>calloc</tt> */
+#define xcalloc(nmemb, size) __checked_call(xcalloc, nmemb, size)
+
+/*! @brief checked <tt>realloc</tt> */
+#define xrealloc(ptr, size) __checked_call(xrealloc, ptr, size)
+
+/*! @brief checked <tt>strdup</tt> */
+#define xstrdup(s) __checked_call(xstrdup, s)
+
+/*! @brief checked <tt>mmap</tt> */
+#define xmmap(addr, length, prot, flags, fd, offset) \
+	__checked_call(xmmap, addr, length, prot, flags, fd, offset)
+
+/*! @brief checked <tt>munmap</tt> */
+#define xmunmap(addr, length) __checked_call(xmunmap, addr, length)
+
+/*! @brief checked <tt>pthread_mutex_lock</tt> */
+#define xpthread_mutex_lock(mutex) __checked_call(xpthread_mutex_lock, mutex)
+
+/*! @brief checked <tt>pthread_mutex_unlock</tt> */
+#define xpthread_mutex_unlock(mutex) \
+	__checked_call(xpthread_mutex_unlock, mutex)
+
+/*! @brief checked <tt>pthread_create</tt> */
+#define xpthread_create(thread, attr, start, arg) \
+	__checked_call(xpthread_create, thread, attr, start, arg)
+
+/*! @} checked */
+
+#endif
@@ -0,0 +1,175 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "trace.h"
+
+/* number of traces tracked by storm suppression */
+#define DUMP_SLOTS 256
+
+typedef struct {
+	uint64_t fingerprint;
+	time_t start;
+	unsigned long suppressed;
+	const char *file;
+	const char *func;
+	int line;
+} dump_slot_t;
+
+static unsigned dump_window = 0;
+static time_t (*dump_clock)(void) = NULL;
+static dump_slot_t dump_slots[DUMP_SLOTS];
+static unsigned dump_pending = 0; /* slots with suppressed traces */
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a over the sites and errno values of all frames, the site strings are
+ * compared by address since they are string literals. origin is set to the
+ * oldest record, where the exception was thrown */
+static
+uint64_t dump_fingerprint(trace_t *origin)
+{
+	uint64_t h = 14695981039346656037ULL;
+	trace_t t;
+
+	for (size_t i = 0; trace_get(i, &t); i++) {
+		uint64_t v[] = {
+			(uintptr_t) t.file, (uintptr_t) t.func,
+			(uint64_t) t.line, (uint64_t) t.errnum
+		};
+
+		for (size_t j = 0; j < sizeof(v) / sizeof(v[0]); j++) {
+			h ^= v[j];
+			h *= 1099511628211ULL;
+		}
+
+		*origin = t;
+	}
+
+	return h;
+}
+
+static
+time_t dump_now(void)
+{
+	time_t (*now)(void) = __atomic_load_n(&dump_clock, __ATOMIC_RELAXED);
+
+	if (now)
+		return now();
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static
+void dump_summary(int fd, dump_slot_t *slot)
+{
+	char buf[512];
+
+	if (slot->suppressed == 0)
+		return;
+
+	int len = snprintf(buf, sizeof(buf),
+			"suppressed %lu identical traces at %s:%d in %s()\n",
+			slot->suppressed, slot->file, slot->line, slot->func);
+
+	write(fd, buf, len < (int) sizeof(buf) ? len : (int) sizeof(buf) - 1);
+	slot->suppressed = 0;
+	__atomic_store_n(&dump_pending, dump_pending - 1, __ATOMIC_RELAXED);
+}
+
+/* report the suppressed traces whose window has expired */
+static
+void dump_expire(int fd, unsigned window)
+{
+	if (__atomic_load_n(&dump_pending, __ATOMIC_RELAXED) == 0)
+		return;
+
+	time_t now = dump_now();
+
+	pthread_mutex_lock(&dump_lock);
+
+	for (size_t i = 0; i < DUMP_SLOTS && dump_pending > 0; i++) {
+		if (now - dump_slots[i].start >= window)
+			dump_summary(fd, &dump_slots[i]);
+	}
+
+	pthread_mutex_unlock(&dump_lock);
+}
+
+/* decide whether the current trace has to be written */
+static
+bool dump_check(int fd, unsigned window)
+{
+	trace_t origin = { 0 };
+	uint64_t fingerprint = dump_fingerprint(&origin);
+	time_t now = dump_now();
+	bool print = true;
+
+	pthread_mutex_lock(&dump_lock);
+
+	dump_slot_t *slot = &dump_slots[fingerprint % DUMP_SLOTS];
+
+	if (slot->fingerprint == fingerprint && now - slot->start < window) {
+		if (slot->suppressed++ == 0)
+			__atomic_store_n(&dump_pending, dump_pending + 1, __ATOMIC_RELAXED);
+
+		print = false;
+	} else {
+		/* window expired or slot taken over by another trace */
+		dump_summary(fd, slot);
+
+		slot->fingerprint = fingerprint;
+		slot->start = now;
+		slot->file = origin.file;
+		slot->func = origin.func;
+		slot->line = origin.line;
+	}
+
+	pthread_mutex_unlock(&dump_lock);
+	return print;
+}
+
+void exception_dump(int fd)
+{
+	unsigned window = __atomic_load_n(&dump_window, __ATOMIC_RELAXED);
+
+	if (window > 0)
+		dump_expire(fd, window);
+
+	if (exception_empty())
+		return;
+
+	if (window > 0 && !dump_check(fd, window))
+		return;
+
+	char *buf = exception_print_all();
+	write(fd, buf, strlen(buf));
+	free(buf);
+}
+
+void exception_dump_limit(unsigned window)
+{
+	__atomic_store_n(&dump_window, window, __ATOMIC_RELAXED);
+}
+
+void exception_dump_clock(time_t (*now)(void))
+{
+	__atomic_store_n(&dump_clock, now, __ATOMIC_RELAXED);
+}
+
+void exception_dump_flush(int fd)
+{
+	pthread_mutex_lock(&dump_lock);
+
+	for (size_t i = 0; i < DUMP_SLOTS; i++)
+		dump_summary(fd, &dump_slots[i]);
+
+	pthread_mutex_unlock(&dump_lock);
+}
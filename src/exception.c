@@ -7,17 +7,74 @@
 
 #include "debug.h"
 #include "exception.h"
-#include "list.h"
+#include "inject.h"
+#include "intern.h"
+#include "probe.h"
+#include "registry.h"
+#include "trace.h"
+
+/* messages up to this size are stored inside the record */
+#define EXCEPTION_MSG_INLINE 64
+
+/* payloads up to this size are stored inside the record */
+#define EXCEPTION_PAYLOAD_INLINE 32
+
+/* minimum size of a payload arena block */
+#define EXCEPTION_ARENA_MIN 1024
+
+/* records are stored in chunks of doubling size, chunk n holds
+ * EXCEPTION_CHUNK_MIN << n records */
+#define EXCEPTION_CHUNK_MIN 8
+#define EXCEPTION_CHUNKS    16
 
 typedef struct {
-	list_t list;
 	const char *file;
 	const char *func;
 	int line;
 	int errnum;
 	char *msg;
+	bool interned;
+	ssize_t ctx;
+	char buf[EXCEPTION_MSG_INLINE];
+	const char *ptype;
+	size_t psize;
+	void *pdata;
+	union {
+		long double ld;
+		long long ll;
+		void *ptr;
+		unsigned char bytes[EXCEPTION_PAYLOAD_INLINE];
+	} pbuf;
 } exception_t;
 
+/* payloads too large for the record are stored in a per-thread arena of
+ * blocks that are reused once the exception stack is cleared */
+typedef struct exception_arena {
+	struct exception_arena *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(16)));
+} exception_arena_t;
+
+typedef struct exception_stack {
+	struct exception_stack *next; /* link in the spare list */
+	exception_t *chunk[EXCEPTION_CHUNKS];
+	size_t depth;
+	unsigned seq;
+	char *ctx;
+	size_t ctx_len;
+	size_t ctx_size;
+	exception_arena_t *arena;
+	exception_arena_t *arena_cur;
+	unsigned long thrown;
+	unsigned long injected;
+} exception_head_t;
+
+/* stacks are never freed because exception_snapshot may still read them,
+ * detached stacks that are no longer needed are kept for reuse instead */
+static exception_head_t *exception_spare;
+static pthread_mutex_t exception_spare_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static pthread_key_t exception_head_key;
 static pthread_once_t exception_head_once = PTHREAD_ONCE_INIT;
 
@@ -27,43 +84,132 @@ void exception_key_init(void)
 	pthread_key_create(&exception_head_key, NULL);
 }
 
+/* records visible to exception_snapshot are only modified between
+ * exception_seq_begin and exception_seq_end */
+static inline
+void exception_seq_begin(exception_head_t *head)
+{
+	__atomic_store_n(&head->seq, head->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline
+void exception_seq_end(exception_head_t *head)
+{
+	__atomic_store_n(&head->seq, head->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline
+exception_head_t *exception_head(void)
+{
+	return pthread_getspecific(exception_head_key);
+}
+
+/* map a stack index to its chunk and the offset within that chunk */
+static inline
+exception_t *exception_at(exception_head_t *head, size_t i)
+{
+	size_t n = i / EXCEPTION_CHUNK_MIN + 1;
+	int k = sizeof(long) * 8 - 1 - __builtin_clzl(n);
+	return &head->chunk[k][i - EXCEPTION_CHUNK_MIN * ((1UL << k) - 1)];
+}
+
+/* get the next free record on top of the stack, chunks are allocated on
+ * first use and kept for the lifetime of the thread */
+static
+exception_t *exception_alloc(exception_head_t *head)
+{
+	size_t i = head->depth;
+	size_t n = i / EXCEPTION_CHUNK_MIN + 1;
+	int k = sizeof(long) * 8 - 1 - __builtin_clzl(n);
+
+	if (k >= EXCEPTION_CHUNKS) {
+		char *ebuf = "FATAL: exception stack overflow\n";
+		write(STDERR_FILENO, ebuf, strlen(ebuf));
+		abort();
+	}
+
+	if (!head->chunk[k])
+		head->chunk[k] = malloc(sizeof(exception_t) * (EXCEPTION_CHUNK_MIN << k));
+
+	return exception_at(head, i);
+}
+
+/* make the record returned by exception_alloc visible */
+static inline
+void exception_publish(exception_head_t *head)
+{
+	__atomic_store_n(&head->depth, head->depth + 1, __ATOMIC_RELEASE);
+}
+
+/* fire a probe for the topmost record and the original errno */
+#define exception_probe(name, head) \
+	probe(name, exception_at(head, (head)->depth - 1)->file, \
+			exception_at(head, (head)->depth - 1)->line, \
+			exception_at(head, (head)->depth - 1)->func, \
+			exception_at(head, 0)->errnum, (head)->depth)
+
+static
+void exception_reset(exception_head_t *head)
+{
+	exception_seq_begin(head);
+
+	for (size_t i = 0; i < head->depth; i++) {
+		exception_t *e = exception_at(head, i);
+
+		if (e->interned)
+			intern_release(e->msg);
+		else if (e->msg != e->buf)
+			free(e->msg);
+	}
+
+	head->depth = 0;
+	head->ctx_len = 0;
+	head->arena_cur = head->arena;
+
+	if (head->arena)
+		head->arena->used = 0;
+
+	exception_seq_end(head);
+}
+
 static
 void exception_init(void)
 {
 	pthread_once(&exception_head_once, exception_key_init);
-	list_t *head = pthread_getspecific(exception_head_key);
+	exception_head_t *head = pthread_getspecific(exception_head_key);
 
 	if (!head) {
-		exception_t *new;
-		LIST_NODE_ALLOC(new);
-		INIT_LIST_HEAD(&(new->list));
-		pthread_setspecific(exception_head_key, &(new->list));
+		/* reuse the stack of a thread that has exited before */
+		registry_t *node = registry_self();
+		head = node->exceptions;
+
+		if (head) {
+			pthread_setspecific(exception_head_key, head);
+			exception_reset(head);
+		} else {
+			head = calloc(1, sizeof(*head));
+			pthread_setspecific(exception_head_key, head);
+			__atomic_store_n(&node->exceptions, head, __ATOMIC_RELEASE);
+		}
 	}
 }
 
 void exception_clear(void)
 {
-	list_t *head = pthread_getspecific(exception_head_key);
-	list_t *pos, *tmp;
+	exception_head_t *head = exception_head();
 
-	if (!head)
+	if (!head || head->depth == 0)
 		return;
 
-	list_for_each_safe(pos, tmp, head) {
-		list_del(pos);
-		exception_t *e = list_entry(pos, exception_t, list);
-
-		if (e->msg)
-			free(e->msg);
-		free(e);
-	}
+	exception_probe(catch, head);
+	exception_reset(head);
 }
 
 bool exception_empty(void)
 {
 	exception_init();
-	list_t *head = pthread_getspecific(exception_head_key);
-	return list_empty(head);
+	return exception_head()->depth == 0;
 }
 
 int exception_errno(void)
@@ -71,49 +217,280 @@ int exception_errno(void)
 	if (exception_empty())
 		return 0;
 
-	list_t *head = pthread_getspecific(exception_head_key);
-	list_t *pos = head->prev;
-	exception_t *e = list_entry(pos, exception_t, list);
-
-	return e->errnum;
+	return exception_at(exception_head(), 0)->errnum;
 }
 
-int exception_push(const char *file, int line, const char *func,
-		int errnum, const char *fmt, ...)
+static
+exception_t *exception_record(const char *file, int line, const char *func,
+		int errnum)
 {
 	exception_init();
 
-	exception_t *new;
-	LIST_NODE_ALLOC(new);
+	exception_t *new = exception_alloc(exception_head());
 
-	new->file   = file;
-	new->func   = func;
-	new->line   = line;
-	new->errnum = errnum;
+	new->file     = file;
+	new->func     = func;
+	new->line     = line;
+	new->errnum   = errnum;
+	new->msg      = NULL;
+	new->interned = false;
+	new->ctx      = -1;
+	new->ptype    = NULL;
 
-	if (fmt == NULL) {
-		new->msg = NULL;
-	} else {
+	return new;
+}
+
+int exception_push(const char *file, int line, const char *func,
+		int errnum, const char *fmt, ...)
+{
+	exception_t *new = exception_record(file, line, func, errnum);
+
+	if (fmt != NULL) {
 		va_list ap;
 		va_start(ap, fmt);
-		vasprintf(&new->msg, fmt, ap);
+		int len = vsnprintf(new->buf, sizeof(new->buf), fmt, ap);
 		va_end(ap);
+
+		if (len >= 0 && len < (int) sizeof(new->buf)) {
+			new->msg = new->buf;
+		} else {
+			va_start(ap, fmt);
+			new->msg = intern_format(file, line, fmt, ap);
+			va_end(ap);
+
+			new->interned = new->msg != NULL;
+		}
+
+		if (new->msg == NULL) {
+			va_start(ap, fmt);
+			vasprintf(&new->msg, fmt, ap);
+			va_end(ap);
+		}
 	}
 
 	debug("%s:%d in %s(): errno = %d: %s", new->file, new->line,
 			new->func, new->errnum, new->msg);
 
-	list_t *head = pthread_getspecific(exception_head_key);
-	list_add(&new->list, head);
+	exception_head_t *head = exception_head();
+	__atomic_store_n(&head->thrown, head->thrown + 1, __ATOMIC_RELAXED);
+
+	exception_publish(head);
+	exception_probe(throw, head);
 	return 0;
 }
 
+void exception_replay(const char *file, int line, const char *func,
+		int errnum, const char *msg)
+{
+	exception_t *new = exception_record(file, line, func, errnum);
+
+	/* buf always holds a prefix of the message for exception_snapshot */
+	if (msg != NULL) {
+		int len = snprintf(new->buf, sizeof(new->buf), "%s", msg);
+
+		if (len >= 0 && len < (int) sizeof(new->buf))
+			new->msg = new->buf;
+		else
+			new->msg = strdup(msg);
+	}
+
+	exception_publish(exception_head());
+}
+
+void exception_count_injected(void)
+{
+	exception_init();
+
+	exception_head_t *head = exception_head();
+	__atomic_store_n(&head->injected, head->injected + 1, __ATOMIC_RELAXED);
+}
+
+void exception_counters(void *data, unsigned long *thrown,
+		unsigned long *injected)
+{
+	exception_head_t *head = data;
+	*thrown += __atomic_load_n(&head->thrown, __ATOMIC_RELAXED);
+	*injected += __atomic_load_n(&head->injected, __ATOMIC_RELAXED);
+}
+
+int exception_frame(const char *file, int line, const char *func)
+{
+	exception_record(file, line, func, 0);
+	exception_publish(exception_head());
+	return 0;
+}
+
+void exception_rethrow(void *frame)
+{
+	exception_head_t *head = exception_head();
+
+	if (head && head->depth > 0)
+		exception_probe(rethrow, head);
+
+	tryenv_jmp(frame);
+}
+
+void probe_abort(void)
+{
+	exception_head_t *head = exception_head();
+
+	if (head && head->depth > 0)
+		exception_probe(abort, head);
+}
+
+void exception_annotate(const char *file, int line, const char *func,
+		const char *fmt, ...)
+{
+	if (exception_empty())
+		exception_frame(file, line, func);
+
+	exception_head_t *head = exception_head();
+	exception_t *e = exception_at(head, head->depth - 1);
+
+	/* never overwrite a message, record the context in a new frame instead */
+	if (e->msg || e->ctx >= 0) {
+		exception_frame(file, line, func);
+		e = exception_at(head, head->depth - 1);
+	}
+
+	va_list ap;
+	size_t avail = head->ctx_size - head->ctx_len;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(avail ? head->ctx + head->ctx_len : NULL, avail, fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	if ((size_t) len >= avail) {
+		size_t size = head->ctx_size ? head->ctx_size : 128;
+
+		while (size < head->ctx_len + len + 1)
+			size *= 2;
+
+		head->ctx = realloc(head->ctx, size);
+		head->ctx_size = size;
+
+		va_start(ap, fmt);
+		vsnprintf(head->ctx + head->ctx_len, len + 1, fmt, ap);
+		va_end(ap);
+	}
+
+	/* keep a copy in the record for exception_snapshot */
+	exception_seq_begin(head);
+	e->ctx = head->ctx_len;
+	e->errnum = exception_errno();
+	snprintf(e->buf, sizeof(e->buf), "%s", head->ctx + e->ctx);
+	exception_seq_end(head);
+
+	head->ctx_len += len + 1;
+
+	debug("%s:%d in %s(): errno = %d: %s", e->file, e->line,
+			e->func, e->errnum, head->ctx + e->ctx);
+}
+
 static
-char *exception_print(exception_t *e)
+void *exception_arena_alloc(exception_head_t *head, size_t size)
+{
+	exception_arena_t *a = head->arena_cur, *prev = NULL;
+
+	size = (size + 15) & ~(size_t) 15;
+
+	/* move on to the next block that is large enough, blocks after the
+	 * current one are unused since the last exception_clear */
+	while (a && a->size - a->used < size) {
+		prev = a;
+		a = a->next;
+
+		if (a)
+			a->used = 0;
+	}
+
+	if (!a) {
+		size_t bsize = prev ? prev->size * 2 : EXCEPTION_ARENA_MIN;
+
+		while (bsize < size)
+			bsize *= 2;
+
+		a = malloc(sizeof(*a) + bsize);
+		a->next = NULL;
+		a->size = bsize;
+		a->used = 0;
+
+		if (prev)
+			prev->next = a;
+		else
+			head->arena = a;
+	}
+
+	head->arena_cur = a;
+	a->used += size;
+	return a->data + a->used - size;
+}
+
+void *exception_payload_alloc(const char *type, size_t size)
+{
+	if (exception_empty())
+		return NULL;
+
+	exception_head_t *head = exception_head();
+	exception_t *e = exception_at(head, head->depth - 1);
+
+	if (size <= sizeof(e->pbuf))
+		e->pdata = &e->pbuf;
+	else
+		e->pdata = exception_arena_alloc(head, size);
+
+	e->ptype = type;
+	e->psize = size;
+	return e->pdata;
+}
+
+void *exception_payload(const char *type, size_t size)
+{
+	if (exception_empty())
+		return NULL;
+
+	exception_t *e = exception_at(exception_head(), 0);
+
+	if (!e->ptype || e->psize != size || strcmp(e->ptype, type) != 0)
+		return NULL;
+
+	return e->pdata;
+}
+
+bool trace_get(size_t i, trace_t *frame)
+{
+	exception_head_t *head = exception_head();
+
+	if (!head || i >= head->depth)
+		return false;
+
+	exception_t *e = exception_at(head, head->depth - 1 - i);
+
+	frame->file   = e->file;
+	frame->func   = e->func;
+	frame->line   = e->line;
+	frame->errnum = e->errnum;
+	frame->msg    = e->msg;
+
+	if (frame->msg == NULL && e->ctx >= 0)
+		frame->msg = head->ctx + e->ctx;
+
+	return true;
+}
+
+static
+char *exception_print(exception_head_t *head, exception_t *e)
 {
 	char *buf;
+	const char *msg = e->msg;
+
+	if (msg == NULL && e->ctx >= 0)
+		msg = head->ctx + e->ctx;
 
-	if (e->msg == NULL) {
+	if (msg == NULL) {
 		asprintf(&buf, "at %s:%d in %s():\n",
 				e->file,
 				e->line,
@@ -123,7 +500,7 @@ char *exception_print(exception_t *e)
 				e->file,
 				e->line,
 				e->func,
-				e->msg,
+				msg,
 				e->errnum);
 	}
 
@@ -135,14 +512,19 @@ char *exception_print_all(void)
 	if (exception_empty())
 		return NULL;
 
-	list_t *head = pthread_getspecific(exception_head_key);
-	exception_t *e;
+	return exception_stack_print(exception_head());
+}
+
+char *exception_stack_print(exception_stack_t *head)
+{
+	if (head->depth == 0)
+		return NULL;
 
 	char *buf = NULL;
 	int len = 0;
 
-	list_for_each_entry(e, head, list) {
-		char *ebuf = exception_print(e);
+	for (size_t i = head->depth; i-- > 0; ) {
+		char *ebuf = exception_print(head, exception_at(head, i));
 		int elen = strlen(ebuf);
 
 		buf = realloc(buf, len + elen + 1);
@@ -155,3 +537,131 @@ char *exception_print_all(void)
 	buf[len] = '\0';
 	return buf;
 }
+
+int exception_stack_errno(exception_stack_t *head)
+{
+	if (head->depth == 0)
+		return 0;
+
+	return exception_at(head, 0)->errnum;
+}
+
+/* make head the exception stack of the calling thread */
+static
+void exception_install(exception_head_t *head)
+{
+	pthread_setspecific(exception_head_key, head);
+	__atomic_store_n(&registry_self()->exceptions, head, __ATOMIC_RELEASE);
+}
+
+static
+void exception_spare_put(exception_head_t *head)
+{
+	pthread_mutex_lock(&exception_spare_lock);
+	head->next = exception_spare;
+	exception_spare = head;
+	pthread_mutex_unlock(&exception_spare_lock);
+}
+
+static
+exception_head_t *exception_spare_get(void)
+{
+	pthread_mutex_lock(&exception_spare_lock);
+	exception_head_t *head = exception_spare;
+
+	if (head)
+		exception_spare = head->next;
+
+	pthread_mutex_unlock(&exception_spare_lock);
+
+	return head ? head : calloc(1, sizeof(*head));
+}
+
+exception_stack_t *exception_detach(void)
+{
+	exception_init();
+
+	exception_head_t *head = exception_head();
+	exception_head_t *new = exception_spare_get();
+
+	/* the statistics stay with the thread */
+	new->thrown   = head->thrown;
+	new->injected = head->injected;
+
+	/* readers of the old stack notice the change */
+	exception_seq_begin(head);
+	exception_install(new);
+	__atomic_store_n(&head->thrown, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&head->injected, 0, __ATOMIC_RELAXED);
+	exception_seq_end(head);
+
+	return head;
+}
+
+void exception_attach(exception_stack_t *stack)
+{
+	exception_init();
+
+	exception_head_t *head = exception_head();
+	exception_reset(head);
+
+	stack->thrown   = head->thrown;
+	stack->injected = head->injected;
+
+	exception_install(stack);
+	exception_spare_put(head);
+}
+
+void exception_stack_free(exception_stack_t *stack)
+{
+	exception_reset(stack);
+	exception_spare_put(stack);
+}
+
+void exception_snapshot(void *data, int fd)
+{
+	exception_head_t *head = data;
+	unsigned seq = __atomic_load_n(&head->seq, __ATOMIC_ACQUIRE);
+	size_t depth = __atomic_load_n(&head->depth, __ATOMIC_ACQUIRE);
+
+	char buf[EXCEPTION_MSG_INLINE + 256];
+	size_t len;
+
+	for (size_t i = depth; i-- > 0 && !(seq & 1); ) {
+		exception_t e;
+		memcpy(&e, exception_at(head, i), sizeof(e));
+
+		/* the owner modified the stack while we copied the record */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&head->seq, __ATOMIC_RELAXED) != seq)
+			break;
+
+		e.buf[sizeof(e.buf) - 1] = '\0';
+
+		len = registry_puts(buf, sizeof(buf) - 1, 0, "at ");
+		len = registry_puts(buf, sizeof(buf) - 1, len, e.file);
+		len = registry_puts(buf, sizeof(buf) - 1, len, ":");
+		len = registry_putl(buf, sizeof(buf) - 1, len, e.line);
+		len = registry_puts(buf, sizeof(buf) - 1, len, " in ");
+		len = registry_puts(buf, sizeof(buf) - 1, len, e.func);
+		len = registry_puts(buf, sizeof(buf) - 1, len, "():");
+
+		if (e.msg != NULL || e.ctx >= 0) {
+			len = registry_puts(buf, sizeof(buf) - 1, len, " ");
+			len = registry_puts(buf, sizeof(buf) - 1, len, e.buf);
+			len = registry_puts(buf, sizeof(buf) - 1, len, " (");
+			len = registry_putl(buf, sizeof(buf) - 1, len, e.errnum);
+			len = registry_puts(buf, sizeof(buf) - 1, len, ")");
+		}
+
+		/* the newline always fits */
+		buf[len++] = '\n';
+		write(fd, buf, len);
+		depth = i;
+	}
+
+	if (depth > 0) {
+		len = registry_puts(buf, sizeof(buf), 0, "(exception stack changed)\n");
+		write(fd, buf, len);
+	}
+}
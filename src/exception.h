@@ -32,6 +32,11 @@
 #include <errno.h>
 #include <setjmp.h>
 #include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /*! @defgroup exception exception stack
  *
@@ -96,6 +101,100 @@ int exception_errno(void);
 int exception_push(const char *file, int line, const char *func,
 		int errnum, const char *fmt, ...);
 
+/*! @brief record except frame
+ *
+ * <tt>exception_frame</tt> pushes a record without message for the location
+ * of an <tt>except</tt> block onto the exception stack.
+ *
+ * @note this function should not be used directly, <tt>except</tt> provides
+ * better semantics.
+ *
+ * @param file source file of the except block
+ * @param line source line of the except block
+ * @param func function containing the except block
+ *
+ * @returns zero
+ */
+int exception_frame(const char *file, int line, const char *func);
+
+/*! @brief pass exception to next environment
+ *
+ * <tt>exception_rethrow</tt> jumps to the topmost environment on the stack
+ * without recording a new exception.
+ *
+ * @note this function should not be used directly, <tt>except</tt> and
+ * <tt>rethrow_with</tt> provide better semantics.
+ *
+ * @param frame frame address of the rethrowing function
+ */
+void exception_rethrow(void *frame);
+
+/*! @brief add context to current exception
+ *
+ * <tt>exception_annotate</tt> attaches a context message to the topmost
+ * exception record and copies the original errno into it. the message is
+ * formatted into a per-thread buffer that is reused once the exception stack
+ * is cleared. if the topmost record already carries a message, a new record
+ * for the given location is pushed first.
+ *
+ * @note this function should not be used directly, <tt>rethrow_with</tt>
+ * provides better semantics.
+ *
+ * @param file source file of this context
+ * @param line source line of this context
+ * @param func function where context was added
+ * @param fmt  <tt>printf</tt> compatible context message
+ */
+void exception_annotate(const char *file, int line, const char *func,
+		const char *fmt, ...);
+
+/*! @brief attach payload to exception
+ *
+ * <tt>exception_payload_alloc</tt> reserves storage for a payload of
+ * <tt>size</tt> bytes in the topmost exception record. small payloads are
+ * stored inside the record, larger ones in a per-thread arena that is reused
+ * once the exception stack is cleared.
+ *
+ * @note this function should not be used directly, <tt>throw_data</tt>
+ * provides better semantics.
+ *
+ * @param type name of the payload type
+ * @param size size of the payload type
+ *
+ * @return pointer to payload storage, <tt>NULL</tt> if the exception stack
+ *         is empty
+ */
+void *exception_payload_alloc(const char *type, size_t size);
+
+/*! @brief get exception payload
+ *
+ * <tt>exception_payload</tt> returns the payload of the original exception
+ * if it matches the given type.
+ *
+ * @note this function should not be used directly, <tt>exception_data</tt>
+ * provides better semantics.
+ *
+ * @param type name of the payload type
+ * @param size size of the payload type
+ *
+ * @return pointer to payload, <tt>NULL</tt> if there is no payload of this
+ *         type
+ */
+void *exception_payload(const char *type, size_t size);
+
+/*! @brief intern repeated exception messages
+ *
+ * <tt>exception_intern</tt> enables a per-thread cache for messages that do
+ * not fit into an exception record. identical messages thrown from the same
+ * location share a single reference counted copy instead of being allocated
+ * each time. each thread keeps up to <tt>capacity</tt> messages and evicts
+ * the least recently used one when the cache is full. interning is disabled
+ * by default, a capacity of zero disables it again.
+ *
+ * @param capacity number of messages cached per thread
+ */
+void exception_intern(size_t capacity);
+
 /*! @brief print exception trace
  *
  * <tt>exception_print_all</tt> returns an exception trace in standard
@@ -105,17 +204,136 @@ int exception_push(const char *file, int line, const char *func,
  */
 char *exception_print_all(void);
 
+/*! @brief exception trace formats */
+typedef enum {
+	EXCEPTION_FORMAT_TEXT,   /*!< standard format of <tt>exception_print_all</tt> */
+	EXCEPTION_FORMAT_JSON,   /*!< one JSON object with an array of frames */
+	EXCEPTION_FORMAT_LOGFMT, /*!< one logfmt line per frame */
+} exception_format_t;
+
+/*! @brief format exception trace
+ *
+ * <tt>exception_format</tt> writes the exception trace of the calling thread
+ * in the given format to a caller supplied buffer without allocating memory.
+ * frames are numbered from the topmost record and carry the errno value, its
+ * symbolic name and the message. like <tt>snprintf</tt>, the output is
+ * truncated to fit into <tt>size</tt> bytes including the terminating null
+ * byte.
+ *
+ * @param format trace format
+ * @param buf    output buffer
+ * @param size   size of the output buffer
+ *
+ * @return length of the complete trace, excluding the terminating null byte
+ */
+size_t exception_format(exception_format_t format, char *buf, size_t size);
+
 /*! @brief dump exception trace to file
  *
  * <tt>exception_dump</tt> writes the output of <tt>exception_print_all</tt> to the given file descriptor.
+ * if storm suppression is enabled with <tt>exception_dump_limit</tt>,
+ * repeated traces are counted instead of written, and summaries of traces
+ * whose window has expired are written first. this is also done if the
+ * exception stack is empty, so idle threads can call it periodically.
  *
  * @param fd file descriptor
  */
-#define exception_dump(fd) do { \
-	char *buf = exception_print_all(); \
-	write(fd, buf, strlen(buf)); \
-	free(buf); \
-} while (0)
+void exception_dump(int fd);
+
+/*! @brief suppress repeated exception dumps
+ *
+ * <tt>exception_dump_limit</tt> enables storm suppression for
+ * <tt>exception_dump</tt>. traces are identified by the sequence of their
+ * sites and errno values, messages are not taken into account. the first
+ * occurrence of a trace within <tt>window</tt> seconds is written in full,
+ * repeats are only counted. there is no timer, the count is reported with
+ * the site where the exception was thrown by the first call to
+ * <tt>exception_dump</tt> after the window has expired, or by
+ * <tt>exception_dump_flush</tt>.
+ *
+ * @param window length of the suppression window in seconds, zero disables
+ *               storm suppression
+ */
+void exception_dump_limit(unsigned window);
+
+/*! @brief set clock of storm suppression
+ *
+ * <tt>exception_dump_clock</tt> replaces the monotonic clock used for the
+ * suppression windows of <tt>exception_dump_limit</tt>, e.g. to test expiry
+ * without waiting.
+ *
+ * @param now function returning the current time in seconds, <tt>NULL</tt>
+ *            restores the monotonic clock
+ */
+void exception_dump_clock(time_t (*now)(void));
+
+/*! @brief report suppressed exception dumps
+ *
+ * <tt>exception_dump_flush</tt> writes a summary line for every trace that
+ * has been suppressed since it was last reported.
+ *
+ * @param fd file descriptor
+ */
+void exception_dump_flush(int fd);
+
+/*! @brief dump exception stacks of all threads
+ *
+ * <tt>exception_dump_all_threads</tt> writes the environment stack depth and
+ * the exception trace of every thread that has used the library to the given
+ * file descriptor. other threads are not stopped, a stack that changes while
+ * it is being written is reported as such. it neither allocates memory nor
+ * takes locks, which makes it usable from a <tt>SIGQUIT</tt> handler.
+ *
+ * @param fd file descriptor
+ */
+void exception_dump_all_threads(int fd);
+
+/*! @brief detached exception stack */
+typedef struct exception_stack exception_stack_t;
+
+/*! @brief detach exception stack
+ *
+ * <tt>exception_detach</tt> takes the exception stack away from the calling
+ * thread and leaves an empty stack in its place. the records are not copied,
+ * so the cost does not depend on the depth of the stack.
+ *
+ * @return detached exception stack
+ */
+exception_stack_t *exception_detach(void);
+
+/*! @brief attach exception stack
+ *
+ * <tt>exception_attach</tt> makes a stack returned by
+ * <tt>exception_detach</tt> the exception stack of the calling thread. the
+ * current stack of the thread is discarded. the calling thread does not have
+ * to be the thread the stack was detached from.
+ *
+ * @param stack detached exception stack
+ */
+void exception_attach(exception_stack_t *stack);
+
+/*! @brief get errno of detached exception stack
+ *
+ * @param stack detached exception stack
+ *
+ * @return original errno, zero if the stack is empty
+ */
+int exception_stack_errno(exception_stack_t *stack);
+
+/*! @brief format detached exception stack
+ *
+ * @param stack detached exception stack
+ *
+ * @return dynamically allocated trace like <tt>exception_print_all</tt>,
+ *         <tt>NULL</tt> if the stack is empty
+ */
+char *exception_stack_print(exception_stack_t *stack);
+
+/*! @brief free detached exception stack
+ *
+ * @param stack detached exception stack
+ */
+void exception_stack_free(exception_stack_t *stack);
 
 /*! @} exception */
 
@@ -131,37 +349,327 @@ char *exception_print_all(void);
 /*! @brief create new jump environment
  *
  * <tt>tryenv_push</tt> creates a new <tt>tryenv_t</tt> object for the current
- * jump buffer and pushes it onto the environment stack.
+ * jump buffer and pushes it onto the environment stack. if an exception has
+ * been posted to this thread it is thrown inside the new environment, so the
+ * try block being entered catches it.
  *
  * @note this function should not be used directly, <tt>try</tt> provides
  * better semantics.
  *
- * @param env jump environment returned by <tt>setjmp</tt>
- * @param ret return code from <tt>setjmp</tt>
+ * environments left on the stack by a <tt>return</tt>, <tt>break</tt> or
+ * <tt>goto</tt> out of a try block are removed as soon as a try block in a
+ * calling function, or the same try block again, is entered. see
+ * <tt>tryenv_leak_report</tt>.
+ *
+ * @param env   jump environment returned by <tt>setjmp</tt>
+ * @param ret   return code from <tt>setjmp</tt>
+ * @param frame frame address of the function containing the try block
+ * @param file  source file of the try block
+ * @param line  source line of the try block
+ * @param func  function containing the try block
  */
-void tryenv_push(jmp_buf *env, int ret);
+void tryenv_push(jmp_buf *env, int ret, void *frame, const char *file,
+		int line, const char *func);
 
 /*! @brief remove last jump environment
  *
  * <tt>tryenv_pop</tt> deletes the topmost environment on the environment
- * stack.
+ * stack, after removing leaked environments of functions called from
+ * <tt>frame</tt>.
  *
  * @note this function should not be used directly, <tt>except</tt> provides
  * better semantics.
+ *
+ * @param frame frame address of the function containing the try block
  */
-void tryenv_pop(void);
+void tryenv_pop(void *frame);
 
 /*! @brief jump to last environment
  *
  * <tt>tryenv_jmp</tt> jumps to and deletes the topmost environment the stack.
+ * environments of functions called from <tt>frame</tt> have returned and are
+ * skipped. environments whose jump buffer no longer matches the pushed copy
+ * are skipped as well, which catches most leaked environments of returned
+ * functions at or above <tt>frame</tt>.
  *
  * @note this function should not be used directly, <tt>throw</tt> provides
  * better semantics.
+ *
+ * @param frame frame address of the throwing function
+ */
+void tryenv_jmp(void *frame);
+
+/*! @brief report leaked environments
+ *
+ * <tt>tryenv_leak_report</tt> writes the site of every leaked try block to
+ * <tt>fd</tt> when its environment is removed. a negative <tt>fd</tt>
+ * disables the report. leaks are detected by comparing frame addresses,
+ * which requires a downwards growing stack and does not work for code
+ * switching stacks.
+ *
+ * @param fd file descriptor to write the report to
+ */
+void tryenv_leak_report(int fd);
+
+/*! @brief throw posted exception
+ *
+ * <tt>tryenv_checkpoint</tt> throws the exception posted to this thread with
+ * <tt>exception_post</tt>, if any, and returns otherwise.
+ *
+ * @note this function should not be used directly,
+ * <tt>exception_checkpoint</tt> provides better semantics.
+ *
+ * @param file source file of the checkpoint
+ * @param line source line of the checkpoint
+ * @param func function containing the checkpoint
  */
-void tryenv_jmp(void);
+void tryenv_checkpoint(const char *file, int line, const char *func);
 
 /*! @} tryenv */
 
+/*! @defgroup cancel cancellation
+ *
+ * The cancellation API lets one thread post an exception to another thread.
+ * the target thread throws it inside the next <tt>try</tt> block it enters,
+ * or at its next <tt>exception_checkpoint</tt>, so it unwinds through the
+ * target's environment stack like any other exception.
+ *
+ * @{
+ */
+
+/*! @brief pending exception slot of a thread */
+typedef struct exception_target exception_target_t;
+
+/*! @brief get exception slot of the calling thread
+ *
+ * <tt>exception_target</tt> returns the slot other threads may post
+ * exceptions to. the slot stays valid after the thread has exited, posting to
+ * it then fails.
+ *
+ * @return pointer to exception slot
+ */
+exception_target_t *exception_target(void);
+
+/*! @brief post exception to another thread
+ *
+ * <tt>exception_post</tt> stores an exception in the slot of another thread.
+ * only one exception can be pending per thread, posting to a slot that is
+ * still occupied fails.
+ *
+ * @param target slot returned by <tt>exception_target</tt>
+ * @param errnum <tt>errno</tt> value of the exception
+ * @param fmt    <tt>printf</tt> compatible error message
+ *
+ * @return <tt>true</tt> if the exception has been posted, <tt>false</tt> if
+ *         another exception is still pending or the thread has exited.
+ */
+bool exception_post(exception_target_t *target, int errnum,
+		const char *fmt, ...);
+
+/*! @brief throw posted exception
+ *
+ * <tt>exception_checkpoint</tt> throws the exception posted to the calling
+ * thread, if any. long running code without <tt>try</tt> blocks should call
+ * it regularly to stay cancellable.
+ */
+#define exception_checkpoint() \
+	tryenv_checkpoint(__FILE__, __LINE__, __FUNCTION__)
+
+/*! @} cancel */
+
+/*! @defgroup batch batch processing
+ *
+ * The batch API runs a function for every item of an array inside a single
+ * jump environment. exceptions thrown by an item are recorded in a per-item
+ * result slot and processing continues with the next item, so batches
+ * without failures run at the speed of a plain loop.
+ *
+ * @{
+ */
+
+/*! @brief result of a batch item */
+typedef struct {
+	int errnum;  /*!< errno of the exception, zero if the item succeeded */
+	char *trace; /*!< exception trace of a failed item, <tt>NULL</tt>
+	                  otherwise */
+} exception_result_t;
+
+/*! @brief process items in a batch
+ *
+ * <tt>exception_batch</tt> calls <tt>func</tt> for each of the
+ * <tt>count</tt> items of <tt>size</tt> bytes in <tt>items</tt>. the jump
+ * environment is set up once for the whole batch and only again after an
+ * item failed. exceptions of failed items are handled and their errno and
+ * trace are stored in <tt>results</tt>. an exception thrown while the
+ * environment is set up, such as a posted exception, is not handled and
+ * leaves the batch, the results of items not processed are zeroed. the
+ * exception stack has to be empty when the batch is started.
+ *
+ * @param items   array of items
+ * @param count   number of items
+ * @param size    size of an item
+ * @param func    function called for each item
+ * @param arg     argument passed to <tt>func</tt>
+ * @param results array of <tt>count</tt> result slots, may be <tt>NULL</tt>
+ *
+ * @return number of failed items
+ */
+size_t exception_batch(void *items, size_t count, size_t size,
+		void (*func)(void *item, void *arg), void *arg,
+		exception_result_t *results);
+
+/*! @brief free batch results
+ *
+ * <tt>exception_batch_free</tt> frees the traces stored in
+ * <tt>results</tt> by <tt>exception_batch</tt>.
+ *
+ * @param results array of result slots
+ * @param count   number of result slots
+ */
+void exception_batch_free(exception_result_t *results, size_t count);
+
+/*! @} batch */
+
+/*! @defgroup pool parallel for
+ *
+ * The pool API runs the iterations of a loop on a set of worker threads.
+ * every participant starts on its own range of indices and steals indices
+ * from the others once its range is exhausted. each task runs inside its own
+ * try block and the exceptions of failed tasks are aggregated and thrown in
+ * the calling thread after all tasks completed.
+ *
+ * @{
+ */
+
+/*! @brief opaque worker pool */
+typedef struct exception_pool exception_pool_t;
+
+/*! @brief traces kept of failed tasks */
+typedef enum {
+	EXCEPTION_AGGREGATE_FIRST, /*!< trace of the failed task with the lowest
+	                                index */
+	EXCEPTION_AGGREGATE_ALL,   /*!< traces of all failed tasks */
+} exception_aggregate_t;
+
+/*! @brief create worker pool
+ *
+ * <tt>exception_pool_create</tt> starts <tt>threads</tt> worker threads, or
+ * one less than the number of online processors if <tt>threads</tt> is zero.
+ * the calling thread of <tt>exception_parallel_for</tt> takes part in the
+ * work as well.
+ *
+ * @param threads number of worker threads
+ *
+ * @return new worker pool
+ */
+exception_pool_t *exception_pool_create(unsigned threads);
+
+/*! @brief destroy worker pool
+ *
+ * <tt>exception_pool_destroy</tt> stops and joins the worker threads and
+ * frees the pool.
+ *
+ * @param pool worker pool
+ */
+void exception_pool_destroy(exception_pool_t *pool);
+
+/*! @brief run loop in parallel
+ *
+ * <tt>exception_parallel_for</tt> calls <tt>func</tt> for every index below
+ * <tt>count</tt> and returns once all calls completed. if tasks failed, the
+ * traces selected by <tt>mode</tt> are pushed onto the exception stack of the
+ * calling thread in index order, followed by a summary record, and the
+ * exception is thrown with the errno of the failed task with the lowest
+ * index. exception payloads are not carried over. once 4096 records have been
+ * pushed, further traces are omitted and only counted in the summary record.
+ *
+ * the exception and environment stacks of the worker threads are reused for
+ * all tasks. a pool must not be used by several threads at the same time and
+ * tasks must not use the pool they run on.
+ *
+ * @param pool  worker pool
+ * @param count number of tasks
+ * @param func  function called with the task index
+ * @param arg   argument passed to <tt>func</tt>
+ * @param mode  traces to keep of failed tasks
+ */
+void exception_parallel_for(exception_pool_t *pool, size_t count,
+		void (*func)(size_t i, void *arg), void *arg,
+		exception_aggregate_t mode);
+
+/*! @} pool */
+
+/*! @defgroup inject fault injection
+ *
+ * The fault injection API throws exceptions at marked sites and optionally
+ * at <tt>try</tt> entries to exercise error paths under load. triggers are
+ * evaluated per thread with a seeded pseudo random number generator, so runs
+ * with the same thread schedule are reproducible. defining
+ * <tt>EXCEPTION_NO_INJECT</tt> before including this header compiles all
+ * marked sites out.
+ *
+ * @{
+ */
+
+/*! @brief fault injection configuration */
+typedef struct {
+	unsigned long seed;   /*!< seed of the per-thread generators */
+	double probability;   /*!< probability to throw at a site, 0 to 1 */
+	unsigned long every;  /*!< throw at every nth site, 0 disables */
+	const char *site;     /*!< only sites whose file or function name
+	                           contains this string, <tt>NULL</tt> for all */
+	bool try_entries;     /*!< also throw at <tt>try</tt> entries */
+	int errnum;           /*!< errno thrown at <tt>try</tt> entries,
+	                           <tt>EIO</tt> if zero */
+} exception_inject_t;
+
+/*! @brief fault injection statistics */
+typedef struct {
+	unsigned long injected; /*!< number of injected exceptions */
+	unsigned long organic;  /*!< number of other thrown exceptions */
+} exception_inject_stats_t;
+
+/*! @brief configure fault injection
+ *
+ * <tt>exception_inject</tt> enables fault injection in all threads with the
+ * given configuration. each thread restarts its generator and counter when
+ * it picks up a new configuration.
+ *
+ * @param config configuration, <tt>NULL</tt> disables fault injection
+ */
+void exception_inject(const exception_inject_t *config);
+
+/*! @brief evaluate fault injection triggers
+ *
+ * <tt>exception_inject_check</tt> decides whether an exception should be
+ * injected at the given site.
+ *
+ * @note this function should not be used directly, <tt>inject</tt> provides
+ * better semantics.
+ *
+ * @param file source file of the site
+ * @param line source line of the site
+ * @param func function containing the site
+ *
+ * @return <tt>true</tt> if an exception should be thrown
+ */
+bool exception_inject_check(const char *file, int line, const char *func);
+
+/*! @brief get fault injection statistics
+ *
+ * <tt>exception_inject_stats</tt> sums the number of injected and organic
+ * exceptions thrown by all threads.
+ *
+ * @param stats statistics
+ */
+void exception_inject_stats(exception_inject_stats_t *stats);
+
+/*! @} inject */
+
+#ifdef __cplusplus
+}
+#else
+
 /*! @defgroup semantics try/except semantics
  *
  * The following macros provide try/except semantics ontop of the exception and
@@ -177,7 +685,59 @@ void tryenv_jmp(void);
  */
 #define throw(...) do { \
 	exception_push(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__); \
-	tryenv_jmp(); \
+	tryenv_jmp(__builtin_frame_address(0)); \
+} while (0)
+
+/*! @brief mark fault injection site
+ *
+ * <tt>inject</tt> throws a new exception like <tt>throw</tt> if fault
+ * injection is enabled and triggers for this site, and does nothing
+ * otherwise.
+ */
+#ifdef EXCEPTION_NO_INJECT
+#define inject(...) do { } while (0)
+#else
+#define inject(...) do { \
+	if (exception_inject_check(__FILE__, __LINE__, __FUNCTION__)) \
+		throw(__VA_ARGS__); \
+} while (0)
+#endif
+
+/*! @brief throw new exception with payload
+ *
+ * <tt>throw_data</tt> works like <tt>throw</tt>, but also stores
+ * <tt>value</tt> of type <tt>type</tt> as payload of the exception.
+ * compound literals have to be enclosed in parentheses:
+ *
+ * <pre>throw_data(struct io_error, ((struct io_error) { fd, offset }), EIO, "read failed");</pre>
+ */
+#define throw_data(type, value, ...) do { \
+	exception_push(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__); \
+	*(type *) exception_payload_alloc(#type, sizeof(type)) = (value); \
+	tryenv_jmp(__builtin_frame_address(0)); \
+} while (0)
+
+/*! @brief get exception payload
+ *
+ * <tt>exception_data</tt> returns a pointer of type <tt>type *</tt> to the
+ * payload of the current exception, or <tt>NULL</tt> if the exception has no
+ * payload of this type. the type has to be spelled exactly as in
+ * <tt>throw_data</tt>. the payload is not copied and stays valid until the
+ * exception is handled.
+ */
+#define exception_data(type) \
+	((type *) exception_payload(#type, sizeof(type)))
+
+/*! @brief rethrow exception with additional context
+ *
+ * <tt>rethrow_with</tt> adds a context message to the current exception with
+ * <tt>exception_annotate</tt> and jumps to the next environment on the stack.
+ * the original errno is preserved and no new exception is thrown. it is meant
+ * to be used inside <tt>except</tt> and <tt>on</tt> blocks.
+ */
+#define rethrow_with(...) do { \
+	exception_annotate(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__); \
+	exception_rethrow(__builtin_frame_address(0)); \
 } while (0)
 
 /* executes start before and end after the block */
@@ -193,11 +753,9 @@ void tryenv_jmp(void);
 	     end, __exception_block_pass = 0)
 
 /* push new environment on the stack */
-#define __setjmp_push() do { \
-	jmp_buf __tryenv_buffer; \
-	int __tryenv_ret = setjmp(__tryenv_buffer); \
-	tryenv_push(&__tryenv_buffer, __tryenv_ret); \
-} while (0)
+#define __setjmp_push(buf) \
+	tryenv_push(&buf, setjmp(buf), __builtin_frame_address(0), \
+			__FILE__, __LINE__, __FUNCTION__)
 
 /*! @brief start new try block
  *
@@ -205,18 +763,25 @@ void tryenv_jmp(void);
  * the block. <b>calling <tt>try</tt> without a corresponding <tt>except</tt>
  * will result in undefined behaviour.</b>
  */
-#define try \
-	__setjmp_push(); \
-	if (exception_empty()) \
-		__exception_end(tryenv_pop())
+#define try __try_expand(__COUNTER__)
+
+#define __try_expand(n) __try(n)
+
+/* the jump buffer lives until the end of the enclosing block, tryenv_jmp
+ * compares it with the pushed copy to detect environments of returned
+ * frames */
+#define __try(n) \
+	jmp_buf __tryenv_buffer##n; \
+	if (__setjmp_push(__tryenv_buffer##n), exception_empty()) \
+		__exception_end(tryenv_pop(__builtin_frame_address(0)))
 
 /* this cannot be a macro because __exception_block does not allow brace
  * expressions in for loops */
 static inline
-void __exception_rethrow(int handled)
+void __exception_rethrow(int handled, void *frame)
 {
 	if (!handled)
-		tryenv_jmp();
+		exception_rethrow(frame);
 }
 
 /*! @brief catch exception
@@ -227,8 +792,9 @@ void __exception_rethrow(int handled)
  * <tt>try</tt> will result in undefined behaviour.</b>
  */
 #define except \
-	else __exception_block(__exception_handled = exception_push(__FILE__, __LINE__, __FUNCTION__, 0, NULL), \
-			__exception_rethrow(__exception_handled))
+	else __exception_block(__exception_handled = exception_frame(__FILE__, __LINE__, __FUNCTION__), \
+			__exception_rethrow(__exception_handled, \
+				__builtin_frame_address(0)))
 
 /*! @brief handle exception
  *
@@ -250,4 +816,6 @@ void __exception_rethrow(int handled)
 
 /*! @} semantics */
 
+#endif /* __cplusplus */
+
 #endif
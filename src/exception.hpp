@@ -0,0 +1,348 @@
+// Copyright (c) 2006-2009 Benedikt Böhm <bb@xnull.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _EXCEPTION_HPP
+#define _EXCEPTION_HPP
+
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <exception.h>
+
+/*! @defgroup cxx C++ interface
+ *
+ * The C++ interface connects libexception to C++ exceptions. a
+ * <tt>longjmp</tt> must never leave a C++ frame with destructors, so C code
+ * throwing libexception exceptions is called through <tt>call</tt>, which
+ * turns them into a C++ <tt>error</tt>, and C++ code called from C runs
+ * through <tt>boundary</tt>, which turns C++ exceptions into libexception
+ * exceptions. the exception stack is moved in both directions, never copied.
+ * the try/except macros are not available in C++.
+ *
+ * @{
+ */
+
+namespace libexception {
+
+/*! @brief libexception exception stack as C++ exception
+ *
+ * copies of an <tt>error</tt> share the same exception stack. once the stack
+ * has been released all copies are empty.
+ */
+class error : public std::exception {
+public:
+	/*! @brief take ownership of a detached exception stack */
+	explicit error(exception_stack_t *stack)
+		: holder_(std::make_shared<holder>(stack)) {}
+
+	/*! @brief take the exception stack of the calling thread */
+	static error take()
+	{
+		return error(exception_detach());
+	}
+
+	/*! @brief original errno of the exception */
+	int errnum() const noexcept
+	{
+		return holder_->errnum;
+	}
+
+	/*! @brief trace of the exception, formatted on first use */
+	const char *what() const noexcept override
+	{
+		char *trace = __atomic_load_n(&holder_->trace, __ATOMIC_ACQUIRE);
+		exception_stack_t *stack = __atomic_load_n(&holder_->stack,
+				__ATOMIC_ACQUIRE);
+
+		if (trace || !stack)
+			return trace ? trace : "libexception error";
+
+		trace = exception_stack_print(stack);
+		char *expected = nullptr;
+
+		if (!__atomic_compare_exchange_n(&holder_->trace, &expected, trace,
+					false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			std::free(trace);
+			trace = expected;
+		}
+
+		return trace ? trace : "libexception error";
+	}
+
+	/*! @brief release the exception stack for <tt>exception_attach</tt>
+	 *
+	 * @return exception stack, <tt>NULL</tt> if it has been released
+	 *         already
+	 */
+	exception_stack_t *release() noexcept
+	{
+		return __atomic_exchange_n(&holder_->stack, nullptr, __ATOMIC_ACQ_REL);
+	}
+
+private:
+	struct holder {
+		explicit holder(exception_stack_t *stack)
+			: stack(stack), trace(nullptr),
+			  errnum(exception_stack_errno(stack)) {}
+
+		~holder()
+		{
+			if (stack)
+				exception_stack_free(stack);
+
+			std::free(trace);
+		}
+
+		exception_stack_t *stack;
+		char *trace;
+		int errnum;
+	};
+
+	std::shared_ptr<holder> holder_;
+};
+
+/*! @brief environment of a try block
+ *
+ * <tt>guard</tt> owns the jump buffer of a try block and pops its
+ * environment when it goes out of scope, including when a C++ exception
+ * leaves the scope. the jump buffer has to be set with <tt>setjmp</tt> in the
+ * function owning the guard, see <tt>call</tt>.
+ */
+class guard {
+public:
+	guard() noexcept : frame_(nullptr), active_(false) {}
+
+	guard(const guard &) = delete;
+	guard &operator=(const guard &) = delete;
+
+	~guard()
+	{
+		if (active_)
+			tryenv_pop(frame_);
+	}
+
+	/*! @brief push the environment after <tt>setjmp</tt> returned zero
+	 *
+	 * a posted exception is thrown inside the pushed environment, so it
+	 * jumps back to the <tt>setjmp</tt> of the function owning the guard.
+	 */
+	void push(void *frame, const char *file, int line, const char *func)
+	{
+		frame_ = frame;
+		active_ = true;
+		tryenv_push(&env, 0, frame, file, line, func);
+	}
+
+	/*! @brief mark the environment as popped by <tt>tryenv_jmp</tt> */
+	void jumped() noexcept
+	{
+		active_ = false;
+	}
+
+	jmp_buf env;
+
+private:
+	void *frame_;
+	bool active_;
+};
+
+/*! @brief call C code that throws libexception exceptions
+ *
+ * <tt>call</tt> runs <tt>f</tt> inside a try block. an exception thrown by
+ * <tt>f</tt> is thrown as <tt>error</tt> holding the exception stack, which
+ * leaves the exception stack of the thread empty. <tt>f</tt> must not own
+ * objects with destructors while it throws.
+ *
+ * @param f function to call
+ *
+ * @return result of <tt>f</tt>
+ */
+template <typename F>
+auto call(F &&f, const char *file = __builtin_FILE(),
+		int line = __builtin_LINE(),
+		const char *func = __builtin_FUNCTION()) -> decltype(f())
+{
+	guard g;
+
+	if (setjmp(g.env) != 0) {
+		g.jumped();
+		throw error::take();
+	}
+
+	g.push(__builtin_frame_address(0), file, line, func);
+	return std::forward<F>(f)();
+}
+
+/*! @brief map a C++ exception to an errno value */
+inline int errnum_of(const std::exception &e) noexcept
+{
+	if (auto *x = dynamic_cast<const error *>(&e))
+		return x->errnum();
+	if (auto *x = dynamic_cast<const std::system_error *>(&e))
+		return x->code().value();
+	if (dynamic_cast<const std::bad_alloc *>(&e))
+		return ENOMEM;
+	if (dynamic_cast<const std::invalid_argument *>(&e))
+		return EINVAL;
+	if (dynamic_cast<const std::domain_error *>(&e))
+		return EDOM;
+	if (dynamic_cast<const std::out_of_range *>(&e) ||
+	    dynamic_cast<const std::range_error *>(&e) ||
+	    dynamic_cast<const std::overflow_error *>(&e) ||
+	    dynamic_cast<const std::underflow_error *>(&e))
+		return ERANGE;
+
+	return EIO;
+}
+
+/*! @brief run C++ code called from C
+ *
+ * <tt>boundary</tt> runs <tt>f</tt> and turns a C++ exception leaving it
+ * into a libexception exception thrown at the boundary. the stack of an
+ * <tt>error</tt> is attached again, other exceptions are recorded with the
+ * errno returned by <tt>errnum_of</tt> and their message.
+ *
+ * @param f function to call
+ *
+ * @return result of <tt>f</tt>
+ */
+template <typename F>
+auto boundary(F &&f, const char *file = __builtin_FILE(),
+		int line = __builtin_LINE(),
+		const char *func = __builtin_FUNCTION()) -> decltype(f())
+{
+	/* the jump must not leave a catch block */
+	try {
+		return std::forward<F>(f)();
+	} catch (error &e) {
+		if (exception_stack_t *stack = e.release())
+			exception_attach(stack);
+		else
+			exception_push(file, line, func, e.errnum(), NULL);
+	} catch (std::exception &e) {
+		exception_push(file, line, func, errnum_of(e), "%s", e.what());
+	} catch (...) {
+		exception_push(file, line, func, EIO, "unknown C++ exception");
+	}
+
+	tryenv_jmp(__builtin_frame_address(0));
+	__builtin_unreachable();
+}
+
+/*! @brief handler for errno <tt>N</tt> */
+template <int N, typename F>
+struct handler {
+	F f;
+};
+
+/*! @brief handler for all other errno values */
+template <typename F>
+struct fallback {
+	F f;
+};
+
+/*! @brief handle errno <tt>N</tt> with <tt>f</tt> in <tt>handle</tt> */
+template <int N, typename F>
+handler<N, typename std::decay<F>::type> on(F &&f)
+{
+	return handler<N, typename std::decay<F>::type>{std::forward<F>(f)};
+}
+
+/*! @brief handle all other errno values with <tt>f</tt> in
+ * <tt>handle</tt> */
+template <typename F>
+fallback<typename std::decay<F>::type> otherwise(F &&f)
+{
+	return fallback<typename std::decay<F>::type>{std::forward<F>(f)};
+}
+
+namespace detail {
+
+inline bool dispatch(int, const error &)
+{
+	return false;
+}
+
+template <int N, typename F, typename... H>
+bool dispatch(int errnum, const error &e, handler<N, F> &h, H &... rest);
+
+template <typename F, typename... H>
+bool dispatch(int errnum, const error &e, fallback<F> &h, H &... rest);
+
+/* every handler adds a switch around the handlers following it */
+template <int N, typename F, typename... H>
+bool dispatch(int errnum, const error &e, handler<N, F> &h, H &... rest)
+{
+	switch (errnum) {
+	case N:
+		h.f(e);
+		return true;
+	default:
+		return dispatch(errnum, e, rest...);
+	}
+}
+
+template <typename F, typename... H>
+bool dispatch(int errnum, const error &e, fallback<F> &h, H &... rest)
+{
+	static_assert(sizeof...(H) == 0,
+			"otherwise must be the last handler");
+
+	h.f(e);
+	return true;
+}
+
+} // namespace detail
+
+/*! @brief dispatch error to handlers
+ *
+ * <tt>handle</tt> calls the first handler created with <tt>on</tt> whose
+ * errno matches the error, or a handler created with <tt>otherwise</tt>,
+ * which has to be the last handler. the handlers are resolved at compile time
+ * into nested switches.
+ *
+ * @param e        error to handle
+ * @param handlers handlers created with <tt>on</tt> and <tt>otherwise</tt>
+ *
+ * @return <tt>true</tt> if a handler was called, <tt>false</tt> otherwise
+ */
+template <typename... H>
+bool handle(const error &e, H... handlers)
+{
+	return detail::dispatch(e.errnum(), e, handlers...);
+}
+
+} // namespace libexception
+
+/*! @} cxx */
+
+#endif
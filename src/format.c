@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "trace.h"
+
+/* output buffer that counts the full length even when it is truncated */
+typedef struct {
+	char *buf;
+	size_t size;
+	size_t len;
+} format_out_t;
+
+static inline
+void format_write(format_out_t *out, const char *s, size_t n)
+{
+	if (out->len < out->size) {
+		size_t avail = out->size - out->len;
+		memcpy(out->buf + out->len, s, n < avail ? n : avail);
+	}
+
+	out->len += n;
+}
+
+static inline
+void format_puts(format_out_t *out, const char *s)
+{
+	format_write(out, s, strlen(s));
+}
+
+static
+void format_int(format_out_t *out, int n)
+{
+	char buf[16];
+	format_write(out, buf, snprintf(buf, sizeof(buf), "%d", n));
+}
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* true if any byte of x is below 0x20, a double quote or a backslash */
+static inline
+bool format_special(uint64_t x)
+{
+	uint64_t quote = x ^ (ONES * '"');
+	uint64_t slash = x ^ (ONES * '\\');
+
+	return (((x - ONES * 0x20) & ~x) |
+	        ((quote - ONES) & ~quote) |
+	        ((slash - ONES) & ~slash)) & HIGHS;
+}
+
+/* copy s escaped for a JSON string, plain runs are found eight bytes at a
+ * time and copied in one go */
+static
+void format_escape(format_out_t *out, const char *s)
+{
+	size_t len = strlen(s);
+	size_t i = 0, start = 0;
+
+	while (i < len) {
+		if (i + 8 <= len) {
+			uint64_t x;
+			memcpy(&x, s + i, 8);
+
+			if (!format_special(x)) {
+				i += 8;
+				continue;
+			}
+		}
+
+		unsigned char c = s[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			i++;
+			continue;
+		}
+
+		format_write(out, s + start, i - start);
+
+		char esc[8];
+
+		switch (c) {
+		case '"':  format_write(out, "\\\"", 2); break;
+		case '\\': format_write(out, "\\\\", 2); break;
+		case '\n': format_write(out, "\\n", 2); break;
+		case '\r': format_write(out, "\\r", 2); break;
+		case '\t': format_write(out, "\\t", 2); break;
+		default:
+			format_write(out, esc, snprintf(esc, sizeof(esc), "\\u%04x", c));
+		}
+
+		start = ++i;
+	}
+
+	format_write(out, s + start, len - start);
+}
+
+static
+void format_string(format_out_t *out, const char *s)
+{
+	format_write(out, "\"", 1);
+	format_escape(out, s);
+	format_write(out, "\"", 1);
+}
+
+/* logfmt values are only quoted if they contain spaces, quotes, equal signs
+ * or control characters */
+static
+void format_value(format_out_t *out, const char *s)
+{
+	for (const char *p = s; *p; p++) {
+		if ((unsigned char) *p <= ' ' || *p == '"' || *p == '=' || *p == '\\') {
+			format_string(out, s);
+			return;
+		}
+	}
+
+	if (*s)
+		format_puts(out, s);
+	else
+		format_write(out, "\"\"", 2);
+}
+
+static
+const char *format_errname(int errnum)
+{
+#ifdef HAVE_STRERRORNAME_NP
+	return strerrorname_np(errnum);
+#else
+	switch (errnum) {
+#define ERRNAME(e) case e: return #e;
+	ERRNAME(EPERM) ERRNAME(ENOENT) ERRNAME(ESRCH) ERRNAME(EINTR)
+	ERRNAME(EIO) ERRNAME(ENXIO) ERRNAME(E2BIG) ERRNAME(EBADF)
+	ERRNAME(ECHILD) ERRNAME(EAGAIN) ERRNAME(ENOMEM) ERRNAME(EACCES)
+	ERRNAME(EFAULT) ERRNAME(EBUSY) ERRNAME(EEXIST) ERRNAME(EXDEV)
+	ERRNAME(ENODEV) ERRNAME(ENOTDIR) ERRNAME(EISDIR) ERRNAME(EINVAL)
+	ERRNAME(ENFILE) ERRNAME(EMFILE) ERRNAME(ENOTTY) ERRNAME(EFBIG)
+	ERRNAME(ENOSPC) ERRNAME(ESPIPE) ERRNAME(EROFS) ERRNAME(EMLINK)
+	ERRNAME(EPIPE) ERRNAME(EDOM) ERRNAME(ERANGE) ERRNAME(EDEADLK)
+	ERRNAME(ENAMETOOLONG) ERRNAME(ENOSYS) ERRNAME(ENOTEMPTY)
+	ERRNAME(ENOTSUP) ERRNAME(ECANCELED) ERRNAME(ETIMEDOUT)
+	ERRNAME(ECONNREFUSED) ERRNAME(ECONNRESET) ERRNAME(EHOSTUNREACH)
+	ERRNAME(EADDRINUSE) ERRNAME(EINPROGRESS) ERRNAME(EALREADY)
+#undef ERRNAME
+	default: return NULL;
+	}
+#endif
+}
+
+static
+void format_text(format_out_t *out, size_t i, trace_t *t)
+{
+	format_puts(out, "at ");
+	format_puts(out, t->file);
+	format_write(out, ":", 1);
+	format_int(out, t->line);
+	format_puts(out, " in ");
+	format_puts(out, t->func);
+	format_puts(out, "():");
+
+	if (t->msg) {
+		format_write(out, " ", 1);
+		format_puts(out, t->msg);
+		format_puts(out, " (");
+		format_int(out, t->errnum);
+		format_write(out, ")", 1);
+	}
+
+	format_write(out, "\n", 1);
+}
+
+static
+void format_json(format_out_t *out, size_t i, trace_t *t)
+{
+	const char *errname = format_errname(t->errnum);
+
+	format_puts(out, i ? ",{\"frame\":" : "{\"frame\":");
+	format_int(out, i);
+	format_puts(out, ",\"file\":");
+	format_string(out, t->file);
+	format_puts(out, ",\"line\":");
+	format_int(out, t->line);
+	format_puts(out, ",\"func\":");
+	format_string(out, t->func);
+	format_puts(out, ",\"errno\":");
+	format_int(out, t->errnum);
+
+	if (t->errnum && errname) {
+		format_puts(out, ",\"errname\":");
+		format_string(out, errname);
+	}
+
+	if (t->msg) {
+		format_puts(out, ",\"msg\":");
+		format_string(out, t->msg);
+	}
+
+	format_write(out, "}", 1);
+}
+
+static
+void format_logfmt(format_out_t *out, size_t i, trace_t *t)
+{
+	const char *errname = format_errname(t->errnum);
+
+	format_puts(out, "frame=");
+	format_int(out, i);
+	format_puts(out, " file=");
+	format_value(out, t->file);
+	format_puts(out, " line=");
+	format_int(out, t->line);
+	format_puts(out, " func=");
+	format_value(out, t->func);
+	format_puts(out, " errno=");
+	format_int(out, t->errnum);
+
+	if (t->errnum && errname) {
+		format_puts(out, " errname=");
+		format_puts(out, errname);
+	}
+
+	if (t->msg) {
+		format_puts(out, " msg=");
+		format_value(out, t->msg);
+	}
+
+	format_write(out, "\n", 1);
+}
+
+size_t exception_format(exception_format_t format, char *buf, size_t size)
+{
+	format_out_t out = { buf, size ? size - 1 : 0, 0 };
+	void (*frame)(format_out_t *, size_t, trace_t *);
+	trace_t t;
+
+	switch (format) {
+	case EXCEPTION_FORMAT_JSON:   frame = format_json;   break;
+	case EXCEPTION_FORMAT_LOGFMT: frame = format_logfmt; break;
+	default:                      frame = format_text;   break;
+	}
+
+	if (format == EXCEPTION_FORMAT_JSON) {
+		format_puts(&out, "{\"errno\":");
+		format_int(&out, exception_errno());
+		format_puts(&out, ",\"frames\":[");
+	}
+
+	for (size_t i = 0; trace_get(i, &t); i++)
+		frame(&out, i, &t);
+
+	if (format == EXCEPTION_FORMAT_JSON)
+		format_puts(&out, "]}\n");
+
+	if (size > 0)
+		buf[out.len < out.size ? out.len : out.size] = '\0';
+
+	return out.len;
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "inject.h"
+#include "registry.h"
+
+#define INJECT_SITE_MAX 128
+
+typedef struct {
+	unsigned generation;
+	unsigned thread;
+	uint64_t state;
+	unsigned long count;
+	exception_inject_t config;
+	char site[INJECT_SITE_MAX];
+} inject_head_t;
+
+unsigned inject_generation = 0;
+
+static unsigned inject_next_generation = 0;
+static unsigned inject_threads = 0;
+static exception_inject_t inject_config;
+static char inject_site[INJECT_SITE_MAX];
+static pthread_mutex_t inject_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t inject_head_key;
+static pthread_once_t inject_head_once = PTHREAD_ONCE_INIT;
+
+static
+void inject_key_init(void)
+{
+	pthread_key_create(&inject_head_key, free);
+}
+
+/* splitmix64, used to derive per-thread seeds */
+static
+uint64_t inject_mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* xorshift64* */
+static
+uint64_t inject_random(inject_head_t *head)
+{
+	head->state ^= head->state >> 12;
+	head->state ^= head->state << 25;
+	head->state ^= head->state >> 27;
+	return head->state * 0x2545f4914f6cdd1dULL;
+}
+
+/* get the state of the calling thread, picking up a new configuration */
+static
+inject_head_t *inject_init(unsigned generation)
+{
+	pthread_once(&inject_head_once, inject_key_init);
+	inject_head_t *head = pthread_getspecific(inject_head_key);
+
+	if (!head) {
+		head = calloc(1, sizeof(*head));
+		pthread_setspecific(inject_head_key, head);
+
+		/* threads are numbered in the order they first check a site, so
+		 * runs with the same thread schedule are reproducible */
+		head->thread = __atomic_add_fetch(&inject_threads, 1, __ATOMIC_RELAXED);
+	}
+
+	if (head->generation != generation) {
+		pthread_mutex_lock(&inject_lock);
+		head->config = inject_config;
+		memcpy(head->site, inject_site, sizeof(head->site));
+		pthread_mutex_unlock(&inject_lock);
+
+		head->generation = generation;
+		head->count = 0;
+		head->state = inject_mix(head->config.seed ^ inject_mix(head->thread));
+
+		if (head->state == 0)
+			head->state = 1;
+	}
+
+	return head;
+}
+
+static
+bool inject_check(inject_head_t *head, const char *file, const char *func)
+{
+	if (head->site[0] && !strstr(file, head->site) && !strstr(func, head->site))
+		return false;
+
+	head->count++;
+
+	if (head->config.every > 0 && head->count % head->config.every == 0)
+		return true;
+
+	if (head->config.probability > 0 &&
+	    (inject_random(head) >> 11) * 0x1.0p-53 < head->config.probability)
+		return true;
+
+	return false;
+}
+
+bool exception_inject_check(const char *file, int line, const char *func)
+{
+	unsigned generation = __atomic_load_n(&inject_generation, __ATOMIC_RELAXED);
+
+	if (generation == 0)
+		return false;
+
+	if (!inject_check(inject_init(generation), file, func))
+		return false;
+
+	debug("injecting exception at %s:%d in %s()", file, line, func);
+	exception_count_injected();
+	return true;
+}
+
+int inject_try(unsigned generation, const char *file, int line,
+		const char *func)
+{
+	inject_head_t *head = inject_init(generation);
+
+	if (!head->config.try_entries || !inject_check(head, file, func))
+		return 0;
+
+	debug("injecting exception at try entry %s:%d in %s()", file, line, func);
+	exception_count_injected();
+	return head->config.errnum;
+}
+
+void exception_inject(const exception_inject_t *config)
+{
+	pthread_mutex_lock(&inject_lock);
+
+	if (config) {
+		inject_config = *config;
+		inject_config.site = NULL;
+
+		if (inject_config.errnum == 0)
+			inject_config.errnum = EIO;
+
+		if (config->site)
+			strncpy(inject_site, config->site, sizeof(inject_site) - 1);
+		else
+			inject_site[0] = '\0';
+
+		/* zero is reserved for disabled injection */
+		if (++inject_next_generation == 0)
+			++inject_next_generation;
+
+		__atomic_store_n(&inject_generation, inject_next_generation,
+				__ATOMIC_RELAXED);
+	} else {
+		__atomic_store_n(&inject_generation, 0, __ATOMIC_RELAXED);
+	}
+
+	pthread_mutex_unlock(&inject_lock);
+}
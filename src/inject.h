@@ -0,0 +1,18 @@
+#ifndef _INJECT_H
+#define _INJECT_H
+
+#include <stdbool.h>
+
+/* non-zero while fault injection is configured */
+extern unsigned inject_generation;
+
+/* decide whether to inject an exception at a try entry and return its errno,
+ * zero otherwise. generation is the non-zero value of inject_generation
+ * loaded by the caller */
+int inject_try(unsigned generation, const char *file, int line,
+		const char *func);
+
+/* count an injected exception in the statistics of the calling thread */
+void exception_count_injected(void);
+
+#endif
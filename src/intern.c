@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "intern.h"
+#include "list.h"
+
+typedef struct {
+	list_t hash;
+	list_t lru;
+	const char *file;
+	int line;
+	unsigned refs;
+	uint32_t hval;
+	size_t len;
+	char msg[];
+} intern_t;
+
+typedef struct {
+	list_t *buckets;
+	size_t nbuckets;
+	size_t size;
+	size_t capacity;
+	list_t lru;
+	char *buf;
+	size_t buf_size;
+} intern_head_t;
+
+static size_t intern_capacity = 0;
+
+static pthread_key_t intern_head_key;
+static pthread_once_t intern_head_once = PTHREAD_ONCE_INIT;
+
+/* references are taken by the owner thread only, but detached exception
+ * stacks may drop theirs on any thread */
+static
+void intern_put(intern_t *e)
+{
+	if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(e);
+}
+
+static
+void intern_evict(intern_head_t *head, intern_t *e)
+{
+	list_del(&e->hash);
+	list_del(&e->lru);
+	head->size--;
+	intern_put(e);
+}
+
+/* drop all cached messages, messages still referenced by exception records
+ * are freed once these records are cleared */
+static
+void intern_flush(intern_head_t *head)
+{
+	intern_t *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &head->lru, lru)
+		intern_evict(head, e);
+
+	free(head->buckets);
+	head->buckets = NULL;
+	head->nbuckets = 0;
+	head->capacity = 0;
+}
+
+static
+void intern_destroy(void *data)
+{
+	intern_head_t *head = data;
+	intern_flush(head);
+	free(head->buf);
+	free(head);
+}
+
+static
+void intern_key_init(void)
+{
+	pthread_key_create(&intern_head_key, intern_destroy);
+}
+
+static
+intern_head_t *intern_init(size_t capacity)
+{
+	pthread_once(&intern_head_once, intern_key_init);
+	intern_head_t *head = pthread_getspecific(intern_head_key);
+
+	if (!head) {
+		/* threads only get a cache once interning is enabled */
+		if (capacity == 0)
+			return NULL;
+
+		head = calloc(1, sizeof(*head));
+		INIT_LIST_HEAD(&head->lru);
+		pthread_setspecific(intern_head_key, head);
+	}
+
+	/* the global capacity changed since the cache was set up */
+	if (head->capacity != capacity) {
+		intern_flush(head);
+
+		if (capacity > 0) {
+			size_t n = 1;
+
+			while (n < capacity)
+				n *= 2;
+
+			head->buckets = malloc(sizeof(list_t) * n);
+			head->nbuckets = n;
+			head->capacity = capacity;
+
+			for (size_t i = 0; i < n; i++)
+				INIT_LIST_HEAD(&head->buckets[i]);
+		}
+	}
+
+	return head;
+}
+
+/* FNV-1a over the message, seeded with the site */
+static
+uint32_t intern_hash(const char *file, int line, const char *msg, size_t len)
+{
+	uint32_t h = 2166136261u ^ (uint32_t) (uintptr_t) file ^ (uint32_t) line;
+
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char) msg[i];
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+char *intern_format(const char *file, int line, const char *fmt, va_list ap)
+{
+	size_t capacity = __atomic_load_n(&intern_capacity, __ATOMIC_RELAXED);
+	intern_head_t *head = intern_init(capacity);
+
+	if (!head || capacity == 0)
+		return NULL;
+
+	va_list aq;
+	va_copy(aq, ap);
+	int len = vsnprintf(head->buf, head->buf_size, fmt, aq);
+	va_end(aq);
+
+	if (len < 0)
+		return NULL;
+
+	if ((size_t) len >= head->buf_size) {
+		head->buf_size = len + 1;
+		head->buf = realloc(head->buf, head->buf_size);
+		vsnprintf(head->buf, head->buf_size, fmt, ap);
+	}
+
+	uint32_t hval = intern_hash(file, line, head->buf, len);
+	list_t *bucket = &head->buckets[hval & (head->nbuckets - 1)];
+	intern_t *e;
+
+	list_for_each_entry(e, bucket, hash) {
+		if (e->hval == hval && e->line == line && e->file == file &&
+		    e->len == (size_t) len && memcmp(e->msg, head->buf, len) == 0) {
+			list_move(&e->lru, &head->lru);
+			__atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+			return e->msg;
+		}
+	}
+
+	if (head->size >= head->capacity)
+		intern_evict(head, list_entry(head->lru.prev, intern_t, lru));
+
+	e = malloc(sizeof(*e) + len + 1);
+	e->file = file;
+	e->line = line;
+	e->refs = 2;
+	e->hval = hval;
+	e->len  = len;
+	memcpy(e->msg, head->buf, len + 1);
+
+	list_add(&e->hash, bucket);
+	list_add(&e->lru, &head->lru);
+	head->size++;
+
+	debug("interned %s:%d: %s", file, line, e->msg);
+	return e->msg;
+}
+
+void intern_release(char *msg)
+{
+	intern_put((intern_t *) (msg - offsetof(intern_t, msg)));
+}
+
+void exception_intern(size_t capacity)
+{
+	__atomic_store_n(&intern_capacity, capacity, __ATOMIC_RELAXED);
+}
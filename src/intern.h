@@ -0,0 +1,13 @@
+#ifndef _INTERN_H
+#define _INTERN_H
+
+#include <stdarg.h>
+
+/* format a message and return the shared copy of it for the given site, or
+ * NULL if interning is disabled */
+char *intern_format(const char *file, int line, const char *fmt, va_list ap);
+
+/* drop a reference returned by intern_format */
+void intern_release(char *msg);
+
+#endif
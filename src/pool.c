@@ -0,0 +1,377 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "checked.h"
+#include "trace.h"
+
+#define POOL_CACHELINE 64
+
+/* records of failed tasks pushed onto the stack of the caller */
+#define POOL_RECORDS 4096
+
+/* indices of a participant, other participants steal from it once their own
+ * range is exhausted */
+typedef struct {
+	size_t next;
+	size_t end;
+} __attribute__((aligned(POOL_CACHELINE))) pool_range_t;
+
+typedef struct {
+	const char *file;
+	const char *func;
+	int line;
+	int errnum;
+	char *msg;
+} pool_record_t;
+
+/* exception stack of a failed task, oldest record first */
+typedef struct pool_failure {
+	struct pool_failure *next;
+	size_t index;
+	size_t depth;
+	pool_record_t records[];
+} pool_failure_t;
+
+struct exception_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+
+	unsigned threads;
+	pthread_t *thread;
+	pool_range_t *ranges; /* one per thread plus one for the caller */
+
+	unsigned generation;
+	unsigned active;
+	bool stop;
+
+	/* current job */
+	void (*func)(size_t i, void *arg);
+	void *arg;
+	exception_aggregate_t mode;
+	size_t failed;
+	pool_failure_t *failures;
+};
+
+typedef struct {
+	exception_pool_t *pool;
+	unsigned index;
+} pool_worker_t;
+
+static
+pool_failure_t *pool_capture(size_t index)
+{
+	size_t depth = 0;
+	trace_t t;
+
+	while (trace_get(depth, &t))
+		depth++;
+
+	pool_failure_t *failure = xmalloc(sizeof(*failure) +
+			depth * sizeof(pool_record_t));
+
+	failure->index = index;
+	failure->depth = depth;
+
+	for (size_t i = 0; i < depth; i++) {
+		pool_record_t *r = &failure->records[depth - 1 - i];
+
+		trace_get(i, &t);
+		r->file   = t.file;
+		r->func   = t.func;
+		r->line   = t.line;
+		r->errnum = t.errnum;
+		r->msg    = t.msg ? strdup(t.msg) : NULL;
+	}
+
+	return failure;
+}
+
+static
+void pool_failure_free(pool_failure_t *failure)
+{
+	for (size_t i = 0; i < failure->depth; i++)
+		free(failure->records[i].msg);
+
+	free(failure);
+}
+
+/* record the exception of task i, keeping only the lowest index unless all
+ * traces are requested */
+static
+void pool_fail(exception_pool_t *pool, size_t i)
+{
+	pool_failure_t *failure = pool_capture(i);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->failed++;
+
+	if (pool->mode == EXCEPTION_AGGREGATE_ALL) {
+		failure->next = pool->failures;
+		pool->failures = failure;
+		failure = NULL;
+	} else if (!pool->failures || pool->failures->index > i) {
+		pool_failure_t *old = pool->failures;
+		failure->next = NULL;
+		pool->failures = failure;
+		failure = old;
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	if (failure)
+		pool_failure_free(failure);
+}
+
+static
+void pool_task(exception_pool_t *pool, size_t i)
+{
+	try {
+		pool->func(i, pool->arg);
+	} except {
+		finally {
+			debug("task %zu failed with errno = %d", i, exception_errno());
+			pool_fail(pool, i);
+		}
+	}
+}
+
+static
+bool pool_claim(pool_range_t *range, size_t *i)
+{
+	if (__atomic_load_n(&range->next, __ATOMIC_RELAXED) >= range->end)
+		return false;
+
+	*i = __atomic_fetch_add(&range->next, 1, __ATOMIC_RELAXED);
+	return *i < range->end;
+}
+
+/* run the own range, then steal from the other participants */
+static
+void pool_work(exception_pool_t *pool, unsigned self)
+{
+	unsigned n = pool->threads + 1;
+	size_t i;
+
+	for (unsigned k = 0; k < n; k++) {
+		pool_range_t *range = &pool->ranges[(self + k) % n];
+
+		while (pool_claim(range, &i))
+			pool_task(pool, i);
+	}
+}
+
+static
+void *pool_worker(void *data)
+{
+	pool_worker_t *worker = data;
+	exception_pool_t *pool = worker->pool;
+	unsigned index = worker->index;
+	unsigned seen = 0;
+
+	free(worker);
+	pthread_mutex_lock(&pool->lock);
+
+	for (;;) {
+		while (pool->generation == seen && !pool->stop)
+			pthread_cond_wait(&pool->wake, &pool->lock);
+
+		if (pool->stop)
+			break;
+
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		pool_work(pool, index);
+
+		pthread_mutex_lock(&pool->lock);
+
+		if (--pool->active == 0)
+			pthread_cond_signal(&pool->done);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+exception_pool_t *exception_pool_create(unsigned threads)
+{
+	if (threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = online > 1 ? online - 1 : 1;
+	}
+
+	exception_pool_t *pool = xcalloc(1, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	pool->threads = threads;
+	pool->thread = xcalloc(threads, sizeof(pthread_t));
+
+	void *ranges = NULL;
+
+	if (posix_memalign(&ranges, POOL_CACHELINE,
+				(threads + 1) * sizeof(pool_range_t)) != 0)
+		throw(ENOMEM, "cannot allocate pool ranges");
+
+	pool->ranges = memset(ranges, 0, (threads + 1) * sizeof(pool_range_t));
+
+	for (unsigned i = 0; i < threads; i++) {
+		pool_worker_t *worker = xmalloc(sizeof(*worker));
+		worker->pool = pool;
+		worker->index = i;
+		xpthread_create(&pool->thread[i], NULL, pool_worker, worker);
+	}
+
+	debug("created pool with %u threads", threads);
+	return pool;
+}
+
+void exception_pool_destroy(exception_pool_t *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned i = 0; i < pool->threads; i++)
+		pthread_join(pool->thread[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->lock);
+
+	free(pool->ranges);
+	free(pool->thread);
+	free(pool);
+}
+
+/* drop the failures of a job whose exception is not thrown */
+static
+void pool_discard(exception_pool_t *pool)
+{
+	while (pool->failures) {
+		pool_failure_t *next = pool->failures->next;
+		pool_failure_free(pool->failures);
+		pool->failures = next;
+	}
+}
+
+static
+int pool_failure_cmp(const void *a, const void *b)
+{
+	const pool_failure_t *fa = *(pool_failure_t * const *) a;
+	const pool_failure_t *fb = *(pool_failure_t * const *) b;
+
+	return fa->index < fb->index ? -1 : fa->index > fb->index;
+}
+
+/* push the collected traces in task order onto the stack of the caller */
+static
+void pool_rethrow(exception_pool_t *pool, size_t count)
+{
+	size_t n = 0;
+
+	for (pool_failure_t *f = pool->failures; f; f = f->next)
+		n++;
+
+	pool_failure_t **sorted = xmalloc(n * sizeof(*sorted));
+	n = 0;
+
+	for (pool_failure_t *f = pool->failures; f; f = f->next)
+		sorted[n++] = f;
+
+	qsort(sorted, n, sizeof(*sorted), pool_failure_cmp);
+
+	/* the trace of the first failure is always kept */
+	size_t records = 0, omitted = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (i > 0 && records + sorted[i]->depth > POOL_RECORDS) {
+			omitted++;
+			continue;
+		}
+
+		for (size_t j = 0; j < sorted[i]->depth; j++) {
+			pool_record_t *r = &sorted[i]->records[j];
+			exception_replay(r->file, r->line, r->func, r->errnum, r->msg);
+		}
+
+		records += sorted[i]->depth;
+	}
+
+	/* the failures have been counted by the workers already */
+	char msg[128];
+
+	if (omitted > 0)
+		snprintf(msg, sizeof(msg), "%zu of %zu tasks failed, %zu traces omitted",
+				pool->failed, count, omitted);
+	else
+		snprintf(msg, sizeof(msg), "%zu of %zu tasks failed", pool->failed, count);
+	exception_replay(__FILE__, __LINE__, __FUNCTION__,
+			sorted[0]->records[0].errnum, msg);
+
+	for (size_t i = 0; i < n; i++)
+		pool_failure_free(sorted[i]);
+
+	free(sorted);
+	pool->failures = NULL;
+	tryenv_jmp(__builtin_frame_address(0));
+}
+
+void exception_parallel_for(exception_pool_t *pool, size_t count,
+		void (*func)(size_t i, void *arg), void *arg,
+		exception_aggregate_t mode)
+{
+	unsigned n = pool->threads + 1;
+
+	for (unsigned k = 0; k < n; k++) {
+		pool->ranges[k].next = count * k / n;
+		pool->ranges[k].end  = count * (k + 1) / n;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->func = func;
+	pool->arg = arg;
+	pool->mode = mode;
+	pool->failed = 0;
+	pool->active = pool->threads;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	/* the caller works on the last range. the workers still use the job, so
+	 * an exception leaving the share of the caller is kept until they are
+	 * done */
+	exception_stack_t *volatile escaped = NULL;
+
+	try {
+		pool_work(pool, pool->threads);
+	} except {
+		finally {
+			escaped = exception_detach();
+		}
+	}
+
+	pthread_mutex_lock(&pool->lock);
+
+	while (pool->active > 0)
+		pthread_cond_wait(&pool->done, &pool->lock);
+
+	pthread_mutex_unlock(&pool->lock);
+
+	if (escaped) {
+		pool_discard(pool);
+		exception_attach(escaped);
+		tryenv_jmp(__builtin_frame_address(0));
+	}
+
+	if (pool->failures)
+		pool_rethrow(pool, count);
+}
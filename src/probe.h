@@ -0,0 +1,15 @@
+#ifndef _PROBE_H
+#define _PROBE_H
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define probe(name, file, line, func, errnum, depth) \
+	STAP_PROBE5(libexception, name, file, line, func, errnum, depth)
+#else
+#define probe(name, file, line, func, errnum, depth) do { } while (0)
+#endif
+
+/* fire the abort probe for the current exception */
+void probe_abort(void);
+
+#endif
@@ -0,0 +1,91 @@
+// Copyright (c) 2006-2009 Benedikt Böhm <bb@xnull.de>
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+// 3. The name of the author may not be used to endorse or promote products
+//    derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+// OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+// IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+// INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+// NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+// THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#ifndef _PROPAGATE_H
+#define _PROPAGATE_H
+
+#include <exception.h>
+
+/*! @defgroup propagate return propagation
+ *
+ * The propagate API is an opt-in fast mode for hot leaf functions. an
+ * error-returning function records the exception on the exception stack like
+ * <tt>throw</tt> does, but returns <tt>EXCEPTION_RAISED</tt> instead of
+ * jumping. callers either pass the sentinel on with <tt>propagate</tt> or
+ * turn it into a regular throw with <tt>escalate</tt>, which hands the
+ * exception to the nearest <tt>try</tt> block. handlers use the usual
+ * <tt>except</tt>/<tt>on</tt> blocks.
+ *
+ * @{
+ */
+
+/*! @brief sentinel returned by error-returning functions */
+#define EXCEPTION_RAISED (-1)
+
+/*! @brief declare error-returning function
+ *
+ * <tt>throws</tt> replaces the return type of an error-returning function. such
+ * functions return <tt>int</tt>, any value but <tt>EXCEPTION_RAISED</tt>
+ * denotes success. ignoring the result triggers a compiler warning.
+ */
+#define throws __attribute__((warn_unused_result)) int
+
+/*! @brief raise exception from error-returning function
+ *
+ * <tt>fail</tt> creates a new exception object with <tt>exception_push</tt>
+ * and returns <tt>EXCEPTION_RAISED</tt> from the current function.
+ */
+#define fail(...) do { \
+	exception_push(__FILE__, __LINE__, __FUNCTION__, __VA_ARGS__); \
+	return EXCEPTION_RAISED; \
+} while (0)
+
+/*! @brief pass exception on to the caller
+ *
+ * <tt>propagate</tt> evaluates <tt>expr</tt>, usually a call to an
+ * error-returning function or an assignment of its result, and returns
+ * <tt>EXCEPTION_RAISED</tt> from the current error-returning function if it
+ * failed.
+ */
+#define propagate(expr) do { \
+	if (__builtin_expect((expr) == EXCEPTION_RAISED, 0)) \
+		return EXCEPTION_RAISED; \
+} while (0)
+
+/*! @brief throw exception to nearest try block
+ *
+ * <tt>escalate</tt> evaluates <tt>expr</tt> like <tt>propagate</tt>, but
+ * jumps to the topmost environment on the stack if it failed. the exception
+ * has already been recorded, so no new exception is thrown.
+ */
+#define escalate(expr) do { \
+	if (__builtin_expect((expr) == EXCEPTION_RAISED, 0)) \
+		exception_rethrow(__builtin_frame_address(0)); \
+} while (0)
+
+/*! @} propagate */
+
+#endif
@@ -0,0 +1,151 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "exception.h"
+#include "registry.h"
+
+static registry_t *registry_list;
+
+static pthread_key_t registry_key;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+/* hand the node over to the next new thread, the stacks it points to stay
+ * allocated so concurrent readers never see freed memory */
+static
+void registry_release(void *data)
+{
+	registry_t *node = data;
+	__atomic_store_n(&node->used, 0, __ATOMIC_RELEASE);
+}
+
+static
+void registry_key_init(void)
+{
+	pthread_key_create(&registry_key, registry_release);
+}
+
+static
+registry_t *registry_claim(void)
+{
+	registry_t *node = __atomic_load_n(&registry_list, __ATOMIC_ACQUIRE);
+
+	for (; node; node = node->next) {
+		int unused = 0;
+
+		if (__atomic_compare_exchange_n(&node->used, &unused, 1, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			return node;
+	}
+
+	node = calloc(1, sizeof(*node));
+	node->used = 1;
+	node->next = __atomic_load_n(&registry_list, __ATOMIC_RELAXED);
+
+	while (!__atomic_compare_exchange_n(&registry_list, &node->next, node,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return node;
+}
+
+size_t registry_puts(char *buf, size_t size, size_t len, const char *s)
+{
+	if (!s)
+		s = "(null)";
+
+	while (*s && len < size)
+		buf[len++] = *s++;
+
+	return len;
+}
+
+size_t registry_putul(char *buf, size_t size, size_t len, unsigned long v)
+{
+	char digits[24];
+	size_t n = sizeof(digits);
+
+	digits[--n] = '\0';
+
+	do {
+		digits[--n] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	return registry_puts(buf, size, len, digits + n);
+}
+
+size_t registry_putl(char *buf, size_t size, size_t len, long v)
+{
+	if (v >= 0)
+		return registry_putul(buf, size, len, v);
+
+	len = registry_puts(buf, size, len, "-");
+	return registry_putul(buf, size, len, -(unsigned long) v);
+}
+
+registry_t *registry_self(void)
+{
+	pthread_once(&registry_once, registry_key_init);
+	registry_t *node = pthread_getspecific(registry_key);
+
+	if (!node) {
+		node = registry_claim();
+		node->thread = pthread_self();
+		__atomic_store_n(&node->tryenvs, NULL, __ATOMIC_RELEASE);
+		pthread_setspecific(registry_key, node);
+		debug("registered thread %lu", (unsigned long) node->thread);
+	}
+
+	return node;
+}
+
+void exception_dump_all_threads(int fd)
+{
+	registry_t *node = __atomic_load_n(&registry_list, __ATOMIC_ACQUIRE);
+
+	for (; node; node = node->next) {
+		if (!__atomic_load_n(&node->used, __ATOMIC_ACQUIRE))
+			continue;
+
+		void *tryenvs = __atomic_load_n(&node->tryenvs, __ATOMIC_ACQUIRE);
+		void *exceptions = __atomic_load_n(&node->exceptions, __ATOMIC_ACQUIRE);
+
+		bool pending = false;
+		size_t depth = tryenvs ? tryenv_snapshot(tryenvs, &pending) : 0;
+
+		char buf[128];
+		size_t len = registry_puts(buf, sizeof(buf), 0, "thread ");
+		len = registry_putul(buf, sizeof(buf), len, (unsigned long) node->thread);
+		len = registry_puts(buf, sizeof(buf), len, ": tryenv depth ");
+		len = registry_putul(buf, sizeof(buf), len, depth);
+
+		if (pending)
+			len = registry_puts(buf, sizeof(buf), len, ", exception pending");
+
+		len = registry_puts(buf, sizeof(buf), len, "\n");
+		write(fd, buf, len);
+
+		if (exceptions)
+			exception_snapshot(exceptions, fd);
+	}
+}
+
+void exception_inject_stats(exception_inject_stats_t *stats)
+{
+	registry_t *node = __atomic_load_n(&registry_list, __ATOMIC_ACQUIRE);
+	unsigned long thrown = 0, injected = 0;
+
+	for (; node; node = node->next) {
+		void *exceptions = __atomic_load_n(&node->exceptions, __ATOMIC_ACQUIRE);
+
+		if (exceptions)
+			exception_counters(exceptions, &thrown, &injected);
+	}
+
+	stats->injected = injected;
+	stats->organic = thrown - injected;
+}
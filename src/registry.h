@@ -0,0 +1,40 @@
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* per-thread registry node, nodes are never freed and are handed to new
+ * threads once their owner has exited */
+typedef struct registry {
+	struct registry *next;
+	int used;
+	pthread_t thread;
+	void *exceptions;
+	void *tryenvs;
+} registry_t;
+
+/* append s to buf of size bytes holding len bytes and return the new length,
+ * output that does not fit is truncated. unlike snprintf these are
+ * async-signal-safe */
+size_t registry_puts(char *buf, size_t size, size_t len, const char *s);
+
+/* append the decimal representation of v like registry_puts */
+size_t registry_putul(char *buf, size_t size, size_t len, unsigned long v);
+size_t registry_putl(char *buf, size_t size, size_t len, long v);
+
+/* get the registry node of the calling thread */
+registry_t *registry_self(void);
+
+/* write a snapshot of another thread's exception stack to fd */
+void exception_snapshot(void *head, int fd);
+
+/* add the throw counters of another thread's exception stack */
+void exception_counters(void *head, unsigned long *thrown,
+		unsigned long *injected);
+
+/* get a snapshot of another thread's tryenv stack depth */
+size_t tryenv_snapshot(void *head, bool *pending);
+
+#endif
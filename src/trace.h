@@ -0,0 +1,25 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* read-only view of an exception record */
+typedef struct {
+	const char *file;
+	const char *func;
+	int line;
+	int errnum;
+	const char *msg;
+} trace_t;
+
+/* get record i of the calling thread's exception stack, record 0 being the
+ * topmost one, returns false if there is no such record */
+bool trace_get(size_t i, trace_t *frame);
+
+/* push a record copied from another exception stack onto the calling
+ * thread's stack, it is not counted as thrown and fires no probe */
+void exception_replay(const char *file, int line, const char *func,
+		int errnum, const char *msg);
+
+#endif
@@ -1,25 +1,107 @@
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <setjmp.h>
 #include <pthread.h>
 
 #include "debug.h"
 #include "exception.h"
+#include "inject.h"
 #include "list.h"
+#include "probe.h"
+#include "registry.h"
 
 typedef struct {
 	list_t list;
 	jmp_buf env;
+	jmp_buf *owner; /* jump buffer of the try block */
+	void *frame;    /* frame of the function containing the try block */
+	const char *file;
+	const char *func;
+	int line;
 } tryenv_t;
 
+typedef struct {
+	int errnum;
+	char *msg;
+} tryenv_pending_t;
+
+struct exception_target {
+	tryenv_pending_t *pending;
+};
+
+typedef struct {
+	list_t list;
+	list_t free; /* popped environments kept for reuse */
+	size_t depth;
+	exception_target_t *target;
+	registry_t *node;
+} tryenv_head_t;
+
+static int tryenv_leak_fd = -1;
+
+/* heads of exited threads, linked by their list member. heads are recycled
+ * instead of freed because exception_dump_all_threads may still read them */
+static list_t tryenv_spare = { &tryenv_spare, &tryenv_spare };
+static pthread_mutex_t tryenv_spare_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static pthread_key_t tryenv_head_key;
 static pthread_once_t tryenv_head_once = PTHREAD_ONCE_INIT;
 
+/* marks the slot of an exited thread, posting to it fails */
+static tryenv_pending_t tryenv_dead;
+
+/* targets are never freed or reused since other threads may still post to
+ * them, only the pending exception is dropped */
+static
+void tryenv_kill(exception_target_t *target)
+{
+	tryenv_pending_t *pending = __atomic_exchange_n(&target->pending,
+			&tryenv_dead, __ATOMIC_ACQUIRE);
+
+	if (pending) {
+		free(pending->msg);
+		free(pending);
+	}
+}
+
+static
+void tryenv_free_list(list_t *list)
+{
+	tryenv_t *env, *tmp;
+
+	list_for_each_entry_safe(env, tmp, list, list)
+		free(env);
+}
+
+/* free the environments of an exiting thread and recycle its head */
+static
+void tryenv_release(void *data)
+{
+	tryenv_head_t *head = list_entry(data, tryenv_head_t, list);
+	void *expected = head;
+
+	/* the registry node may already belong to a new thread */
+	__atomic_compare_exchange_n(&head->node->tryenvs, &expected, NULL, false,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+
+	tryenv_free_list(&head->list);
+	tryenv_free_list(&head->free);
+	tryenv_kill(head->target);
+	__atomic_store_n(&head->depth, 0, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&tryenv_spare_lock);
+	list_add(&head->list, &tryenv_spare);
+	pthread_mutex_unlock(&tryenv_spare_lock);
+}
+
 static
 void tryenv_init_key(void)
 {
-	pthread_key_create(&tryenv_head_key, NULL);
+	pthread_key_create(&tryenv_head_key, tryenv_release);
 }
 
 static
@@ -29,11 +111,110 @@ void tryenv_init(void)
 	list_t *head = pthread_getspecific(tryenv_head_key);
 
 	if (!head) {
-		tryenv_t *new;
-		LIST_NODE_ALLOC(new);
+		tryenv_head_t *new = NULL;
+
+		pthread_mutex_lock(&tryenv_spare_lock);
+
+		if (!list_empty(&tryenv_spare)) {
+			new = list_entry(tryenv_spare.next, tryenv_head_t, list);
+			list_del(&new->list);
+		}
+
+		pthread_mutex_unlock(&tryenv_spare_lock);
+
+		if (!new)
+			LIST_NODE_ALLOC(new);
+
+		exception_target_t *target = calloc(1, sizeof(*target));
+
 		INIT_LIST_HEAD(&(new->list));
+		INIT_LIST_HEAD(&(new->free));
+		new->node = registry_self();
+		__atomic_store_n(&new->target, target, __ATOMIC_RELEASE);
 		pthread_setspecific(tryenv_head_key, &(new->list));
+		__atomic_store_n(&new->node->tryenvs, new, __ATOMIC_RELEASE);
+	}
+}
+
+/* the depth is only written by the owner but read by exception_snapshot */
+static inline
+void tryenv_depth_add(tryenv_head_t *head, int n)
+{
+	__atomic_store_n(&head->depth, head->depth + n, __ATOMIC_RELAXED);
+}
+
+static inline
+tryenv_head_t *tryenv_head(void)
+{
+	list_t *head = pthread_getspecific(tryenv_head_key);
+	return list_entry(head, tryenv_head_t, list);
+}
+
+/* throw the pending exception posted to this thread, if any */
+static
+void tryenv_raise(tryenv_head_t *head, void *frame, const char *file,
+		int line, const char *func)
+{
+	tryenv_pending_t *pending = __atomic_exchange_n(&head->target->pending,
+			NULL, __ATOMIC_ACQUIRE);
+
+	if (!pending)
+		return;
+
+	if (pending->msg)
+		exception_push(file, line, func, pending->errnum, "%s", pending->msg);
+	else
+		exception_push(file, line, func, pending->errnum, NULL);
+
+	free(pending->msg);
+	free(pending);
+	tryenv_jmp(frame);
+}
+
+static
+void tryenv_leak(tryenv_head_t *head, tryenv_t *env)
+{
+	probe(leak, env->file, env->line, env->func, 0, head->depth);
+
+	int fd = __atomic_load_n(&tryenv_leak_fd, __ATOMIC_RELAXED);
+
+	if (fd >= 0) {
+		char buf[512];
+		int len = snprintf(buf, sizeof(buf), "leaked try block at %s:%d in %s()\n",
+				env->file, env->line, env->func);
+
+		write(fd, buf, len < (int) sizeof(buf) ? len : (int) sizeof(buf) - 1);
 	}
+
+	debug("pruned environment of %s:%d", env->file, env->line);
+}
+
+/* drop environments whose try block was left without tryenv_pop, i.e.
+ * environments owned by frames below frame (the stack grows down), whose
+ * function has returned, or using the jump buffer owner, which is only
+ * possible if the same try block is entered again */
+static
+void tryenv_prune(tryenv_head_t *head, void *frame, jmp_buf *owner)
+{
+	while (!list_empty(&head->list)) {
+		tryenv_t *env = list_entry(head->list.next, tryenv_t, list);
+
+		if ((uintptr_t) env->frame >= (uintptr_t) frame && env->owner != owner)
+			break;
+
+		tryenv_leak(head, env);
+		list_move(&env->list, &head->free);
+		tryenv_depth_add(head, -1);
+	}
+}
+
+/* the jump buffer of a live try block still holds what setjmp stored, the
+ * frame of a returned function has usually been reused by the calls made
+ * since. only needed for environments not below the throwing function */
+static inline
+bool tryenv_live(tryenv_t *env)
+{
+	return memcmp(env->owner, &env->env, sizeof(jmp_buf)) == 0;
 }
 
 static
@@ -44,19 +225,50 @@ bool tryenv_empty(void)
 	return list_empty(head);
 }
 
-void tryenv_push(jmp_buf *env, int ret)
+void tryenv_push(jmp_buf *env, int ret, void *frame, const char *file,
+		int line, const char *func)
 {
 	if (ret != 0)
 		return;
 
 	tryenv_init();
 
+	tryenv_head_t *head = tryenv_head();
+	tryenv_prune(head, frame, env);
+
 	tryenv_t *new;
-	LIST_NODE_ALLOC(new);
+
+	if (list_empty(&head->free)) {
+		LIST_NODE_ALLOC(new);
+	} else {
+		new = list_entry(head->free.next, tryenv_t, list);
+		list_del(&new->list);
+	}
+
 	memcpy(&new->env, env, sizeof(jmp_buf));
+	new->owner = env;
+	new->frame = frame;
+	new->file  = file;
+	new->func  = func;
+	new->line  = line;
 
-	list_t *head = pthread_getspecific(tryenv_head_key);
-	list_add(&new->list, head);
+	list_add(&new->list, &head->list);
+	tryenv_depth_add(head, 1);
+
+	/* posted and injected exceptions are thrown inside the new try block */
+	if (__atomic_load_n(&head->target->pending, __ATOMIC_RELAXED))
+		tryenv_raise(head, frame, file, line, func);
+
+	unsigned generation = __atomic_load_n(&inject_generation, __ATOMIC_RELAXED);
+
+	if (generation) {
+		int errnum = inject_try(generation, file, line, func);
+
+		if (errnum) {
+			exception_push(file, line, func, errnum, "injected exception");
+			tryenv_jmp(frame);
+		}
+	}
 }
 
 static
@@ -71,36 +283,116 @@ void tryenv_default_handler(void)
 		ebuf = exception_print_all();
 
 	write(STDERR_FILENO, ebuf, strlen(ebuf));
+	probe_abort();
 	abort();
 }
 
-void tryenv_pop(void)
+void tryenv_pop(void *frame)
 {
 	if (tryenv_empty())
 		return;
 
-	list_t *head = pthread_getspecific(tryenv_head_key);
-	list_t *pos = head->next;
-	tryenv_t *env = list_entry(pos, tryenv_t, list);
+	tryenv_head_t *head = tryenv_head();
+	tryenv_prune(head, frame, NULL);
+
+	if (list_empty(&head->list))
+		return;
 
-	list_del(pos);
-	free(env);
+	list_t *pos = head->list.next;
+
+	list_move(pos, &head->free);
+	tryenv_depth_add(head, -1);
 }
 
-void tryenv_jmp(void)
+void tryenv_jmp(void *frame)
 {
-	if (tryenv_empty())
-		tryenv_default_handler();
+	tryenv_init();
 
-	list_t *head = pthread_getspecific(tryenv_head_key);
-	list_t *pos = head->next;
-	tryenv_t *env = list_entry(pos, tryenv_t, list);
+	tryenv_head_t *head = tryenv_head();
+	tryenv_t *env;
+
+	for (;;) {
+		/* functions called from frame have returned */
+		tryenv_prune(head, frame, NULL);
+
+		if (list_empty(&head->list))
+			tryenv_default_handler();
+
+		env = list_entry(head->list.next, tryenv_t, list);
 
-	jmp_buf buf;
-	memcpy(&buf, &env->env, sizeof(jmp_buf));
+		if (tryenv_live(env))
+			break;
 
-	list_del(pos);
-	free(env);
+		tryenv_leak(head, env);
+		list_move(&env->list, &head->free);
+		tryenv_depth_add(head, -1);
+	}
+
+	list_t *pos = &env->list;
+
+	/* the environment stays valid on the free list */
+	list_move(pos, &head->free);
+	tryenv_depth_add(head, -1);
+
+	longjmp(env->env, 1);
+}
+
+void tryenv_leak_report(int fd)
+{
+	__atomic_store_n(&tryenv_leak_fd, fd, __ATOMIC_RELAXED);
+}
+
+void tryenv_checkpoint(const char *file, int line, const char *func)
+{
+	tryenv_init();
+
+	tryenv_head_t *head = tryenv_head();
+
+	if (__atomic_load_n(&head->target->pending, __ATOMIC_RELAXED))
+		tryenv_raise(head, __builtin_frame_address(0), file, line, func);
+}
+
+exception_target_t *exception_target(void)
+{
+	tryenv_init();
+	return tryenv_head()->target;
+}
+
+bool exception_post(exception_target_t *target, int errnum,
+		const char *fmt, ...)
+{
+	tryenv_pending_t *new = malloc(sizeof(*new));
+	new->errnum = errnum;
+
+	if (fmt == NULL) {
+		new->msg = NULL;
+	} else {
+		va_list ap;
+		va_start(ap, fmt);
+		vasprintf(&new->msg, fmt, ap);
+		va_end(ap);
+	}
+
+	tryenv_pending_t *expected = NULL;
+
+	if (!__atomic_compare_exchange_n(&target->pending, &expected, new, false,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		free(new->msg);
+		free(new);
+		return false;
+	}
+
+	debug("posted errno = %d", errnum);
+	return true;
+}
+
+size_t tryenv_snapshot(void *data, bool *pending)
+{
+	tryenv_head_t *head = data;
+	exception_target_t *target = __atomic_load_n(&head->target, __ATOMIC_ACQUIRE);
+	tryenv_pending_t *p = target ?
+		__atomic_load_n(&target->pending, __ATOMIC_RELAXED) : NULL;
 
-	longjmp(buf, 1);
+	*pending = p && p != &tryenv_dead;
+	return __atomic_load_n(&head->depth, __ATOMIC_RELAXED);
 }
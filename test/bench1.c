@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <exception.h>
+#include <propagate.h>
+
+#define ITERATIONS 1000000
+
+static volatile int input = -1;
+
+static
+void leaf_throw(int n)
+{
+	if (n < 0)
+		throw(1, "negative value");
+}
+
+static
+void func_throw(int n)
+{
+	leaf_throw(n);
+}
+
+static
+throws leaf_fail(int n)
+{
+	if (n < 0)
+		fail(1, "negative value");
+
+	return n;
+}
+
+static
+throws func_fail(int n)
+{
+	propagate(leaf_fail(n));
+	return 0;
+}
+
+static
+void run_throw(int n)
+{
+	try { func_throw(n); }
+	except { on (1) { } }
+}
+
+static
+void run_escalate(int n)
+{
+	try { escalate(func_fail(n)); }
+	except { on (1) { } }
+}
+
+static
+void run_return(int n)
+{
+	if (func_fail(n) == EXCEPTION_RAISED)
+		exception_clear();
+}
+
+static
+void bench(const char *name, void (*run)(int), int n)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < ITERATIONS; i++)
+		run(n);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%-32s %6.1f ns/op\n", name,
+			((end.tv_sec - start.tv_sec) * 1e9 +
+			 (end.tv_nsec - start.tv_nsec)) / ITERATIONS);
+}
+
+int main(int argc, char *argv[])
+{
+	bench("setjmp path, error:", run_throw, input);
+	bench("return path, escalate to try:", run_escalate, input);
+	bench("return path, handled by caller:", run_return, input);
+	bench("setjmp path, no error:", run_throw, -input);
+	bench("return path, escalate, no error:", run_escalate, -input);
+	bench("return path, no error:", run_return, -input);
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <exception.h>
+
+#define ITERATIONS 1000000
+
+static volatile int sink;
+
+static
+void request(int n)
+{
+	try {
+		sink = n;
+	} except {
+		on (EIO) {
+			sink = -n;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	double rates[] = { 0, 0.01, 0.1, 0.5 };
+	exception_inject_stats_t stats;
+
+	for (int r = 0; r < 4; r++) {
+		exception_inject_t config = { .seed = 1, .probability = rates[r],
+			.try_entries = true };
+		struct timespec start, end;
+
+		exception_inject(&config);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < ITERATIONS; i++)
+			request(i);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+
+		printf("%4.0f%% injected at try entry: %6.1f ns/op\n", rates[r] * 100,
+				((end.tv_sec - start.tv_sec) * 1e9 +
+				 (end.tv_nsec - start.tv_nsec)) / ITERATIONS);
+	}
+
+	exception_inject_stats(&stats);
+	printf("injected: %lu, organic: %lu\n", stats.injected, stats.organic);
+	return 0;
+}
@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <exception.h>
+
+#define ITEMS 1000000
+
+static unsigned failure_rate;
+
+static
+void process(void *item, void *arg)
+{
+	int *n = item;
+
+	if (failure_rate && *n % failure_rate == 0)
+		throw(EIO, "item %d failed", *n);
+
+	*n += 1;
+}
+
+static
+void run_try(int *items)
+{
+	for (int i = 0; i < ITEMS; i++) {
+		try {
+			process(&items[i], NULL);
+		} except {
+			on (EIO) { }
+		}
+	}
+}
+
+static
+void run_batch(int *items)
+{
+	exception_batch(items, ITEMS, sizeof(int), process, NULL, NULL);
+}
+
+static
+void bench(const char *name, void (*run)(int *), int *items)
+{
+	struct timespec start, end;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	run(items);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	printf("%-32s %6.1f ns/item\n", name,
+			((end.tv_sec - start.tv_sec) * 1e9 +
+			 (end.tv_nsec - start.tv_nsec)) / ITEMS);
+}
+
+int main(int argc, char *argv[])
+{
+	int *items = calloc(ITEMS, sizeof(int));
+
+	for (int i = 0; i < ITEMS; i++)
+		items[i] = i * 7 + 1;
+
+	bench("try per item, no failures:", run_try, items);
+	bench("batch, no failures:", run_batch, items);
+
+	failure_rate = 100;
+	bench("try per item, 1% failures:", run_try, items);
+	bench("batch, 1% failures:", run_batch, items);
+
+	free(items);
+	return 0;
+}
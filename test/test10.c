@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <exception.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int state = 0;
+
+static
+void wait_state(int n)
+{
+	pthread_mutex_lock(&lock);
+	while (state != n)
+		pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+static
+void set_state(int n)
+{
+	pthread_mutex_lock(&lock);
+	state = n;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static
+void *func1(void *arg)
+{
+	try {
+		try {
+			throw(1, "worker error");
+		} except {
+			/* hold the exception while main dumps all threads */
+			set_state(1);
+			wait_state(2);
+		}
+	} except {
+		finally {
+			continue;
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t thread;
+	int fds[2];
+	char buf[4096];
+	int rc = 1;
+
+	pipe(fds);
+	pthread_create(&thread, NULL, func1, NULL);
+
+	wait_state(1);
+	exception_dump_all_threads(fds[1]);
+	set_state(2);
+	pthread_join(thread, NULL);
+
+	close(fds[1]);
+	ssize_t len = read(fds[0], buf, sizeof(buf) - 1);
+
+	if (len > 0) {
+		buf[len] = '\0';
+		write(STDERR_FILENO, buf, len);
+
+		if (strstr(buf, "tryenv depth 1\n") &&
+		    strstr(buf, "worker error (1)"))
+			rc = 0;
+	}
+
+	return rc;
+}
@@ -0,0 +1,50 @@
+#include <stdlib.h>
+#include <exception.h>
+#include <propagate.h>
+
+static
+throws func3(int n)
+{
+	if (n < 0)
+		fail(1, "negative value %d", n);
+
+	return n * 2;
+}
+
+static
+throws func2(int n)
+{
+	int m;
+	propagate(m = func3(n));
+	return m + 1;
+}
+
+static
+void func1(int n)
+{
+	escalate(func2(n));
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = 2;
+
+	if (func2(1) != 3)
+		return 1;
+
+	if (func2(-1) == EXCEPTION_RAISED && exception_errno() == 1) {
+		exception_clear();
+		rc--;
+	}
+
+	try {
+		func1(-1);
+	} except {
+		on (1) {
+			exception_dump(STDERR_FILENO);
+			rc--;
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,52 @@
+#include <stdlib.h>
+#include <exception.h>
+
+#define LONG_MSG "a message that is too long to be stored inside the exception record %d"
+
+static
+void func2(int n)
+{
+	throw(1, LONG_MSG, n);
+}
+
+/* the second message evicts the first one while it is still in use */
+static
+int func1(void)
+{
+	int matches = 0;
+
+	try {
+		try { func2(0); }
+		except { func2(1); }
+	} except {
+		on (1) {
+			char *buf = exception_print_all();
+
+			if (strstr(buf, "exception record 0 (1)"))
+				matches++;
+			if (strstr(buf, "exception record 1 (1)"))
+				matches++;
+
+			exception_dump(STDERR_FILENO);
+			free(buf);
+		}
+	}
+
+	return matches;
+}
+
+int main(int argc, char *argv[])
+{
+	exception_intern(1);
+
+	for (int i = 0; i < 4; i++)
+		if (func1() != 2)
+			return 1;
+
+	exception_intern(0);
+
+	if (func1() != 2)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <exception.h>
+
+struct request_error {
+	int request;
+	long offset;
+};
+
+struct large_error {
+	char path[256];
+	int status;
+};
+
+static
+void func2(int request)
+{
+	throw_data(struct request_error, ((struct request_error) { request, 4096 }),
+			EIO, "request %d failed", request);
+}
+
+static
+void func1(void)
+{
+	struct large_error e = { "/var/lib/data", 503 };
+	throw_data(struct large_error, e, EAGAIN, "backend unavailable");
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = 2;
+
+	try {
+		func2(42);
+	} except {
+		on (EIO) {
+			struct request_error *e = exception_data(struct request_error);
+
+			if (e && e->request == 42 && e->offset == 4096 &&
+			    !exception_data(struct large_error))
+				rc--;
+		}
+	}
+
+	try {
+		func1();
+	} except {
+		on (EAGAIN) {
+			struct large_error *e = exception_data(struct large_error);
+
+			if (e && e->status == 503 && !strcmp(e->path, "/var/lib/data"))
+				rc--;
+		}
+	}
+
+	return rc;
+}
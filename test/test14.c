@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <exception.h>
+
+static
+void func2(void)
+{
+	inject(EIO, "injected read error");
+}
+
+static
+void func1(void)
+{
+	inject(ENOMEM, "injected allocation error");
+}
+
+static
+int run(int n, void (*func)(void))
+{
+	int failed = 0;
+
+	for (int i = 0; i < n; i++) {
+		try {
+			func();
+		} except {
+			finally {
+				failed++;
+			}
+		}
+	}
+
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	exception_inject_t config = { .every = 4, .site = "func2" };
+	exception_inject_stats_t stats;
+
+	exception_inject(&config);
+
+	if (run(100, func2) != 25 || run(100, func1) != 0)
+		return 1;
+
+	/* the same seed yields the same sequence of injected exceptions */
+	exception_inject_t random = { .seed = 42, .probability = 0.5,
+		.site = "run", .try_entries = true };
+
+	exception_inject(&random);
+	int first = run(1000, func1);
+
+	exception_inject(&random);
+	int second = run(1000, func1);
+
+	if (first != second || first < 400 || first > 600)
+		return 1;
+
+	exception_inject(NULL);
+
+	if (run(100, func2) != 0)
+		return 1;
+
+	try {
+		throw(EINVAL, "organic error");
+	} except {
+		finally {
+		}
+	}
+
+	exception_inject_stats(&stats);
+
+	if (stats.injected != 25 + first + second || stats.organic != 1)
+		return 1;
+
+	return 0;
+}
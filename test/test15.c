@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <exception.h>
+
+static
+void func2(void)
+{
+	throw(ENOENT, "file \"%s\" not found\n", "a\\b");
+}
+
+static
+void func1(void)
+{
+	try { func2(); }
+	except { rethrow_with("while loading config=%s", "main"); }
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = 3;
+
+	try {
+		func1();
+	} except {
+		on (ENOENT) {
+			char buf[1024], small[16];
+
+			size_t len = exception_format(EXCEPTION_FORMAT_JSON, buf, sizeof(buf));
+			write(STDERR_FILENO, buf, len);
+
+			if (len == strlen(buf) &&
+			    strstr(buf, "{\"errno\":2,\"frames\":[{\"frame\":0,") &&
+			    strstr(buf, "\"errname\":\"ENOENT\",\"msg\":\"file \\\"a\\\\b\\\" not found\\n\"}]}\n"))
+				rc--;
+
+			len = exception_format(EXCEPTION_FORMAT_LOGFMT, buf, sizeof(buf));
+			write(STDERR_FILENO, buf, len);
+
+			if (strstr(buf, "frame=1 file=test15.c line=14 func=func1 errno=2 errname=ENOENT msg=\"while loading config=main\"\n"))
+				rc--;
+
+			/* truncated output reports the full length */
+			char *text = exception_print_all();
+
+			if (exception_format(EXCEPTION_FORMAT_TEXT, small, sizeof(small)) == strlen(text) &&
+			    strlen(small) == sizeof(small) - 1 &&
+			    strncmp(small, text, sizeof(small) - 1) == 0)
+				rc--;
+
+			free(text);
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <exception.h>
+
+static
+void func2(int n)
+{
+	throw(1, "request %d failed", n);
+}
+
+static
+void func1(int fd, int n)
+{
+	try {
+		func2(n);
+	} except {
+		on (1) {
+			exception_dump(fd);
+		}
+	}
+}
+
+static
+void func3(int fd)
+{
+	try {
+		throw(2, "timeout");
+	} except {
+		on (2) {
+			exception_dump(fd);
+		}
+	}
+}
+
+static time_t clock_now = 1000;
+
+static
+time_t fake_clock(void)
+{
+	return clock_now;
+}
+
+static
+ssize_t drain(int fd, char *buf, size_t size)
+{
+	ssize_t len = read(fd, buf, size - 1);
+
+	if (len <= 0)
+		return 0;
+
+	buf[len] = '\0';
+	write(STDERR_FILENO, buf, len);
+	return len;
+}
+
+int main(int argc, char *argv[])
+{
+	int fds[2];
+	char buf[4096];
+
+	pipe(fds);
+	exception_dump_limit(3600);
+
+	/* messages differ, but the sites are the same */
+	for (int i = 0; i < 100; i++)
+		func1(fds[1], i);
+
+	exception_dump_flush(fds[1]);
+
+	if (!drain(fds[0], buf, sizeof(buf)) ||
+	    !strstr(buf, "request 0 failed") ||
+	    strstr(buf, "request 1 failed") ||
+	    !strstr(buf, "suppressed 99 identical traces at test16.c:7 in func2()\n"))
+		return 1;
+
+	/* expired windows are reported by the next dump, even without exception */
+	exception_dump_clock(fake_clock);
+	exception_dump_limit(2);
+
+	for (int i = 0; i < 3; i++)
+		func3(fds[1]);
+
+	clock_now += 3;
+	exception_dump(fds[1]);
+
+	if (!drain(fds[0], buf, sizeof(buf)) ||
+	    !strstr(buf, "suppressed 2 identical traces at test16.c:26 in func3()\n"))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <exception.h>
+
+static
+void func1(void *item, void *arg)
+{
+	int *n = item;
+
+	if (*n % 3 == 0)
+		throw(*n, "item %d failed", *n);
+
+	*(int *) arg += *n;
+}
+
+/* fails item 2 and cancels the batch */
+static
+void func2(void *item, void *arg)
+{
+	int *n = item;
+
+	if (*n == 3) {
+		exception_post(exception_target(), ECANCELED, "batch cancelled");
+		throw(*n, "item %d failed", *n);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int items[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+	exception_result_t results[10];
+	int sum = 0;
+
+	if (exception_batch(items, 10, sizeof(int), func1, &sum, results) != 3)
+		return 1;
+
+	if (sum != 1 + 2 + 4 + 5 + 7 + 8 + 10)
+		return 1;
+
+	for (int i = 0; i < 10; i++) {
+		if (items[i] % 3 == 0) {
+			if (results[i].errnum != items[i] || !strstr(results[i].trace, "failed"))
+				return 1;
+
+			write(STDERR_FILENO, results[i].trace, strlen(results[i].trace));
+		} else if (results[i].errnum != 0 || results[i].trace) {
+			return 1;
+		}
+	}
+
+	exception_batch_free(results, 10);
+
+	/* a posted exception leaves the batch with all results set */
+	int cancelled = 1;
+
+	for (int i = 0; i < 10; i++)
+		results[i].errnum = -1;
+
+	try {
+		exception_batch(items, 10, sizeof(int), func2, NULL, results);
+	} except {
+		on (ECANCELED) {
+			cancelled = results[2].errnum != 3 || results[3].errnum != 0 ||
+				results[9].trace != NULL;
+		}
+	}
+
+	exception_batch_free(results, 10);
+
+	if (cancelled)
+		return 1;
+
+	/* the batch leaves a balanced environment stack behind */
+	int rc = 1;
+
+	try {
+		exception_batch(items, 10, sizeof(int), func1, &sum, NULL);
+		throw(EINVAL, "after batch");
+	} except {
+		on (EINVAL) {
+			rc = 0;
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <exception.h>
+
+#define TASKS 1000
+
+static
+void sum(size_t i, void *arg)
+{
+	__atomic_fetch_add((unsigned long *) arg, i, __ATOMIC_RELAXED);
+}
+
+static
+void fail(size_t i, void *arg)
+{
+	if (i % 100 == 50)
+		throw(EIO + (i == 50), "task %zu failed", i);
+}
+
+static
+void fail_all(size_t i, void *arg)
+{
+	throw(EIO, "task %zu failed with a message that is too long for the inline buffer", i);
+}
+
+static unsigned running;
+
+static
+void slow(size_t i, void *arg)
+{
+	__atomic_add_fetch(&running, 1, __ATOMIC_RELAXED);
+	usleep(1000);
+	__atomic_sub_fetch(&running, 1, __ATOMIC_RELAXED);
+}
+
+static
+size_t count(const char *trace, const char *needle)
+{
+	size_t n = 0;
+
+	for (const char *p = trace; (p = strstr(p, needle)); p++)
+		n++;
+
+	return n;
+}
+
+static
+int run(exception_pool_t *pool, exception_aggregate_t mode, size_t traces)
+{
+	int rc = 1;
+
+	try {
+		exception_parallel_for(pool, TASKS, fail, NULL, mode);
+	} except {
+		on (EIO + 1) {
+			char *trace = exception_print_all();
+			write(STDERR_FILENO, trace, strlen(trace));
+
+			if (count(trace, "in fail()") == traces &&
+					strstr(trace, "task 50 failed") &&
+					strstr(trace, "10 of 1000 tasks failed"))
+				rc = 0;
+
+			free(trace);
+		}
+	}
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	exception_pool_t *pool = exception_pool_create(3);
+	unsigned long total = 0;
+
+	for (int i = 0; i < 10; i++)
+		exception_parallel_for(pool, TASKS, sum, &total, EXCEPTION_AGGREGATE_FIRST);
+
+	if (total != 10UL * TASKS * (TASKS - 1) / 2)
+		return 1;
+
+	if (run(pool, EXCEPTION_AGGREGATE_FIRST, 1) != 0)
+		return 1;
+
+	exception_inject_stats_t before, after;
+	exception_inject_stats(&before);
+
+	if (run(pool, EXCEPTION_AGGREGATE_ALL, 10) != 0)
+		return 1;
+
+	/* the rethrown traces are not counted a second time */
+	exception_inject_stats(&after);
+
+	if (after.organic - before.organic != 10)
+		return 1;
+
+	/* only a bounded number of traces is pushed onto the caller's stack */
+	int bounded = 1;
+
+	try {
+		exception_parallel_for(pool, 5000, fail_all, NULL, EXCEPTION_AGGREGATE_ALL);
+	} except {
+		on (EIO) {
+			char *trace = exception_print_all();
+
+			bounded = count(trace, "in fail_all()") != 2048 ||
+				!strstr(trace, "5000 of 5000 tasks failed, 2952 traces omitted");
+
+			free(trace);
+
+			/* replayed messages are visible to the signal-safe dump */
+			FILE *f = tmpfile();
+			static char dump[1 << 20];
+
+			exception_dump_all_threads(fileno(f));
+			rewind(f);
+			dump[fread(dump, 1, sizeof(dump) - 1, f)] = '\0';
+			fclose(f);
+
+			if (!strstr(dump, "in fail_all(): task 0 failed with a message"))
+				bounded = 1;
+		}
+	}
+
+	if (bounded)
+		return 1;
+
+	/* an exception posted to the caller is thrown once all tasks are done */
+	int cancelled = 1;
+
+	if (!exception_post(exception_target(), ECANCELED, "cancelled"))
+		return 1;
+
+	try {
+		exception_parallel_for(pool, 100, slow, NULL, EXCEPTION_AGGREGATE_FIRST);
+	} except {
+		on (ECANCELED) {
+			cancelled = __atomic_load_n(&running, __ATOMIC_RELAXED) != 0;
+		}
+	}
+
+	if (cancelled)
+		return 1;
+
+	/* the pool stays usable after failures */
+	total = 0;
+	exception_parallel_for(pool, 7, sum, &total, EXCEPTION_AGGREGATE_ALL);
+
+	exception_pool_destroy(pool);
+	return total == 21 ? 0 : 1;
+}
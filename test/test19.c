@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <exception.h>
+
+/* leaves the try block without popping its environment */
+static
+int leak(int n)
+{
+	try {
+		if (n >= 0)
+			return n;
+	} except {
+		finally { }
+	}
+
+	return -1;
+}
+
+/* like leak, but its try block lies far below the frame of the caller */
+static
+int leak_large(int n)
+{
+	volatile char buf[32768];
+
+	buf[0] = n;
+
+	try {
+		if (n >= 0)
+			return buf[0];
+	} except {
+		finally {
+			abort();
+		}
+	}
+
+	return -1;
+}
+
+static
+int thrower(void)
+{
+	int rc = 1;
+
+	try {
+		throw(EINVAL, "after leak");
+	} except {
+		on (EINVAL) {
+			rc = 0;
+		}
+	}
+
+	return rc;
+}
+
+/* throws without a try block of its own */
+static
+void helper(void)
+{
+	throw(ENOENT, "through helper");
+}
+
+static
+size_t count(const char *buf, const char *needle)
+{
+	size_t n = 0;
+
+	for (const char *p = buf; (p = strstr(p, needle)); p++)
+		n++;
+
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	int fds[2];
+	static char buf[65536];
+
+	if (pipe(fds) != 0)
+		return 1;
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	tryenv_leak_report(fds[1]);
+
+	/* re-entering the same try block prunes its stale environment */
+	for (int i = 0; i < 1000; i++)
+		leak(i);
+
+	/* a throw must not jump into the returned frame of leak */
+	if (thrower() != 0)
+		return 1;
+
+	/* the pop of the outer try skips the leaked environment */
+	int rc = 1;
+
+	try {
+		leak(1);
+	} except {
+		finally { }
+	}
+
+	try {
+		throw(EIO, "outer");
+	} except {
+		on (EIO) {
+			rc = 0;
+		}
+	}
+
+	/* a throw right after the leak skips the dead environment */
+	int direct = 1;
+
+	try {
+		leak(1);
+		throw(EIO, "after leak");
+	} except {
+		on (EIO) {
+			direct = 0;
+		}
+	}
+
+	if (direct != 0)
+		return 1;
+
+	/* so does a throw from a function without a try block */
+	int nested = 1;
+
+	try {
+		leak(1);
+		helper();
+	} except {
+		on (ENOENT) {
+			nested = 0;
+		}
+	}
+
+	if (nested != 0)
+		return 1;
+
+	/* the leaked environment lies below the thrower, whatever the stack
+	 * still holds */
+	int large = 1;
+
+	try {
+		leak_large(1);
+		throw(EIO, "after large leak");
+	} except {
+		on (EIO) {
+			large = 0;
+		}
+	}
+
+	if (large != 0)
+		return 1;
+
+	tryenv_leak_report(-1);
+
+	ssize_t len = read(fds[0], buf, sizeof(buf) - 1);
+
+	if (len <= 0)
+		return 1;
+
+	buf[len] = '\0';
+	write(STDERR_FILENO, buf, len);
+
+	if (count(buf, "leaked try block at test19.c:9 in leak()\n") != 1003 ||
+	    count(buf, "in leak_large()\n") != 1)
+		return 1;
+
+	return rc;
+}
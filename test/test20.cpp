@@ -0,0 +1,105 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <exception.hpp>
+
+extern "C" {
+void nested(int errnum);
+int guarded(void (*cb)(void *), void *arg, char **trace);
+}
+
+static
+void raise_runtime(void *arg)
+{
+	libexception::boundary([] {
+		throw std::invalid_argument("bad argument");
+	});
+}
+
+static
+void raise_error(void *arg)
+{
+	libexception::boundary([arg] {
+		throw *static_cast<libexception::error *>(arg);
+	});
+}
+
+static
+bool contains(const char *trace, const char *needle)
+{
+	return trace && std::strstr(trace, needle);
+}
+
+int main(int argc, char *argv[])
+{
+	/* C to C++ */
+	try {
+		libexception::call([] { nested(ENOENT); });
+		return 1;
+	} catch (const libexception::error &e) {
+		if (e.errnum() != ENOENT || !exception_empty())
+			return 1;
+
+		if (!contains(e.what(), "inner failed") ||
+				!contains(e.what(), "while nesting"))
+			return 1;
+
+		int which = 0;
+
+		libexception::handle(e,
+			libexception::on<EINVAL>([&](const libexception::error &) { which = 1; }),
+			libexception::on<ENOENT>([&](const libexception::error &) { which = 2; }),
+			libexception::otherwise([&](const libexception::error &) { which = 3; }));
+
+		if (which != 2)
+			return 1;
+
+		if (libexception::handle(e, libexception::on<EINVAL>([](const libexception::error &) { })))
+			return 1;
+	}
+
+	/* a C++ exception leaving call pops its environment */
+	try {
+		libexception::call([] { throw std::runtime_error("c++"); });
+	} catch (const std::runtime_error &) {
+	}
+
+	/* an exception posted before call is thrown inside its environment */
+	try {
+		if (!exception_post(exception_target(), ECANCELED, "cancelled"))
+			return 1;
+
+		libexception::call([] { });
+		return 1;
+	} catch (const libexception::error &e) {
+		if (e.errnum() != ECANCELED || !exception_empty() ||
+				!contains(e.what(), "cancelled"))
+			return 1;
+	}
+
+	char *trace = NULL;
+
+	/* C++ to C */
+	if (guarded(raise_runtime, NULL, &trace) != EINVAL ||
+			!contains(trace, "bad argument"))
+		return 1;
+
+	std::free(trace);
+	trace = NULL;
+
+	/* C to C++ and back, the stack is moved both ways */
+	try {
+		libexception::call([] { nested(EPERM); });
+	} catch (libexception::error &e) {
+		if (guarded(raise_error, &e, &trace) != EPERM ||
+				!contains(trace, "inner failed"))
+			return 1;
+
+		if (e.release() != NULL)
+			return 1;
+	}
+
+	std::free(trace);
+
+	return exception_empty() ? 0 : 1;
+}
@@ -0,0 +1,35 @@
+#include <stdlib.h>
+#include <exception.h>
+
+static
+void inner(int errnum)
+{
+	throw(errnum, "inner failed");
+}
+
+void nested(int errnum)
+{
+	try {
+		inner(errnum);
+	} except {
+		rethrow_with("while nesting");
+	}
+}
+
+/* run cb inside a try block and return the errno and trace of the caught
+ * exception */
+int guarded(void (*cb)(void *), void *arg, char **trace)
+{
+	volatile int rc = 0;
+
+	try {
+		cb(arg);
+	} except {
+		finally {
+			rc = exception_errno();
+			*trace = exception_print_all();
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,38 @@
+#include <stdlib.h>
+#include <exception.h>
+
+static
+void func2(void)
+{
+	throw(1, "test error");
+}
+
+static
+void func1(int request)
+{
+	try { func2(); }
+	except { rethrow_with("while handling request %d", request); }
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = 1;
+
+	try {
+		func1(42);
+	} except {
+		on (1) {
+			char *buf = exception_print_all();
+
+			if (strstr(buf, "while handling request 42 (1)"))
+				rc = 0;
+
+			exception_dump(STDERR_FILENO);
+			free(buf);
+		} finally {
+			exception_dump(STDERR_FILENO);
+		}
+	}
+
+	return rc;
+}
@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <exception.h>
+
+static pthread_barrier_t barrier;
+static exception_target_t *worker_target;
+
+static
+void *func1(void *target)
+{
+	if (!exception_post(target, ECANCELED, "request cancelled"))
+		abort();
+
+	return NULL;
+}
+
+static
+void post(exception_target_t *target)
+{
+	pthread_t thread;
+	pthread_create(&thread, NULL, func1, target);
+	pthread_join(thread, NULL);
+}
+
+/* a thread whose only try block receives the post */
+static
+void *worker(void *data)
+{
+	int *rc = data;
+
+	worker_target = exception_target();
+	pthread_barrier_wait(&barrier);
+	pthread_barrier_wait(&barrier);
+
+	try {
+		*rc = 1;
+	} except {
+		on (ECANCELED) {
+			exception_dump(STDERR_FILENO);
+			*rc = 0;
+		}
+	}
+
+	return NULL;
+}
+
+/* runs on a thread that may reuse the state of the exited worker */
+static
+void *idle(void *data)
+{
+	int *rc = data;
+
+	try {
+		*rc = 0;
+	} except {
+		finally {
+			*rc = 1;
+		}
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	exception_target_t *target = exception_target();
+	int rc = 3;
+
+	/* the post is thrown inside the try block being entered */
+	try {
+		post(target);
+
+		if (exception_post(target, EINVAL, "second post"))
+			abort();
+
+		try {
+			rc = 4;
+		} except {
+			on (ECANCELED) {
+				exception_dump(STDERR_FILENO);
+				rc--;
+			}
+		}
+	} except {
+		finally {
+			rc = 4;
+		}
+	}
+
+	try {
+		post(target);
+		exception_checkpoint();
+		rc = 4;
+	} except {
+		on (ECANCELED) {
+			exception_dump(STDERR_FILENO);
+			rc--;
+		}
+	}
+
+	pthread_t thread;
+	int worker_rc = 2;
+
+	pthread_barrier_init(&barrier, NULL, 2);
+	pthread_create(&thread, NULL, worker, &worker_rc);
+	pthread_barrier_wait(&barrier);
+
+	if (!exception_post(worker_target, ECANCELED, "deadline exceeded"))
+		abort();
+
+	pthread_barrier_wait(&barrier);
+	pthread_join(thread, NULL);
+	pthread_barrier_destroy(&barrier);
+
+	if (worker_rc == 0)
+		rc--;
+
+	/* posts to exited threads fail and never reach new threads */
+	if (exception_post(worker_target, ECANCELED, "too late"))
+		return 1;
+
+	int idle_rc = 2;
+
+	pthread_create(&thread, NULL, idle, &idle_rc);
+	pthread_join(thread, NULL);
+
+	if (idle_rc != 0)
+		return 1;
+
+	return rc;
+}
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <exception.h>
+#include <checked.h>
+
+static
+void func1(void)
+{
+	char buf[16];
+	char *ptr = xmalloc(sizeof(buf));
+
+	free(ptr);
+	xread(-1, buf, sizeof(buf));
+}
+
+static
+void func2(void)
+{
+	xopen("/nonexistent/libexception", O_RDONLY, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = 2;
+
+	try {
+		func1();
+	} except {
+		on (EBADF) {
+			exception_dump(STDERR_FILENO);
+			rc--;
+		}
+	}
+
+	try {
+		func2();
+	} except {
+		on (ENOENT) {
+			exception_dump(STDERR_FILENO);
+			rc--;
+		}
+	}
+
+	return rc;
+}
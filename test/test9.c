@@ -0,0 +1,51 @@
+#include <stdlib.h>
+#include <exception.h>
+
+#define LONG_MSG "a message that is too long to be stored inside the exception record itself"
+
+static
+void func2(int depth)
+{
+	if (depth == 0)
+		throw(1, "%s", LONG_MSG);
+
+	try { func2(depth - 1); }
+	except { continue; }
+}
+
+static
+int func1(void)
+{
+	int frames = 0;
+
+	try {
+		func2(40);
+	} except {
+		on (1) {
+			char *buf = exception_print_all();
+
+			for (char *p = buf; (p = strchr(p, '\n')); p++)
+				frames++;
+
+			if (!strstr(buf, LONG_MSG))
+				frames = 0;
+
+			free(buf);
+		}
+	}
+
+	return frames;
+}
+
+int main(int argc, char *argv[])
+{
+	/* 40 except frames in func2, the throw and the except frame in func1 */
+	if (func1() != 42)
+		return 1;
+
+	/* the second run reuses the records of the first one */
+	if (func1() != 42)
+		return 1;
+
+	return 0;
+}